@@ -1,6 +1,7 @@
 #include <viskit/dataset.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 /* Some ATA datasets are missing the flags for their final visibility
  * record. (This happens occasionally when the data catcher is shut
@@ -10,7 +11,8 @@
  * We're actually not using the MaskItem interface since it doesn't
  * support the kind of read-write operations that we'd like to do
  * here. (We could do it in a streaming way, but that'd require reading
- * through all of the flags, which isn't necessary here.)
+ * through all of the flags, which isn't necessary here.) Instead we
+ * open the flags item read-write and patch its end.
  */
 
 #define NCHAN 1024
@@ -23,8 +25,9 @@ main (int argc, char **argv)
     GError *err = NULL;
     gint64 ncorr, nflags, nrecsmissing, nbitslastrec;
     DSItemInfo *finfo;
-    gchar *flagsfn;
-    FILE *flags;
+    IOStream *flags;
+    struct stat statbuf;
+    goffset flagsend;
     guint32 buf[BUFSZ], tmp;
     int i, j;
     size_t ntowrite;
@@ -78,11 +81,6 @@ main (int argc, char **argv)
 	return 1;
     }
 
-    if (ds_close (vis, &err)) {
-	fprintf (stderr, "Error closing dataset \"%s\": %s\n", argv[1], err->message);
-	return 1;
-    }
-
     /* Initialize data to write to flags file -- this may be modified below
      * if there are extra bits at the end of the flags file that we need to
      * preserve. We zero out the middle (DC) channel because that's what the
@@ -117,54 +115,63 @@ main (int argc, char **argv)
 
     /* Now we begin the surgery. */
 
-    flagsfn = g_strdup_printf ("%s/flags", argv[1]);
-    if ((flags = fopen (flagsfn, "r+")) == NULL) {
-	fprintf (stderr, "Error opening flags file \"%s\" for modification: %s\n",
-		 flagsfn, g_strerror (errno));
+    if ((flags = ds_open_large_item (vis, "flags", IO_MODE_READ_WRITE,
+				     DS_OFLAGS_NONE, &err)) == NULL) {
+	fprintf (stderr, "Error opening \"flags\" item for modification: %s\n",
+		 err->message);
 	return 1;
     }
 
+    if (fstat (io_get_fd (flags), &statbuf)) {
+	fprintf (stderr, "Error getting size of \"flags\" item: %s\n",
+		 g_strerror (errno));
+	return 1;
+    }
+
+    flagsend = statbuf.st_size;
+
     if (nbitslastrec != 0) {
-	if (fseek (flags, -4, SEEK_END) < 0) {
-	    fprintf (stderr, "Error seeking to near-end of flags file \"%s\": %s\n",
-		     flagsfn, g_strerror (errno));
+	if (io_seek (flags, flagsend - 4, &err)) {
+	    fprintf (stderr, "Error seeking to near-end of \"flags\" item: %s\n",
+		     err->message);
 	    return 1;
 	}
 
-	if (fread (&tmp, 4, 1, flags) != 1) {
-	    fprintf (stderr, "Error reading end of flags file \"%s\": %s\n",
-		     flagsfn, g_strerror (errno));
+	if (io_read_into_user_buf (flags, DST_I32, 1, &tmp, &err) != 1) {
+	    fprintf (stderr, "Error reading end of \"flags\" item: %s\n",
+		     err != NULL ? err->message : "truncated item");
 	    return 1;
 	}
 
 	/* Our bits are all 1s over here so we can just apply the
-	 * previous flags with an &. Breaks if NCHAN < 64, but it's not. Also
-	 * must pay attention to endianness. */
-	buf[0] &= GINT32_FROM_BE (tmp);
+	 * previous flags with an &. Breaks if NCHAN < 64, but it's not.
+	 * The stream takes care of endianness. */
+	buf[0] &= tmp;
 
 	/* Back up again to rewrite that last int32. */
-	if (fseek (flags, -4, SEEK_END) < 0) {
-	    fprintf (stderr, "Error seeking to near-end of flags file \"%s\": %s\n",
-		     flagsfn, g_strerror (errno));
-	    return 1;
-	}
+	flagsend -= 4;
     }
 
-    for (i = 0; i < ntowrite; i++)
-	buf[i] = GINT32_FROM_BE (buf[i]);
+    if (io_seek (flags, flagsend, &err)) {
+	fprintf (stderr, "Error seeking to end of \"flags\" item: %s\n",
+		 err->message);
+	return 1;
+    }
 
-    if (fwrite (buf, 4, ntowrite, flags) != ntowrite) {
-	fprintf (stderr, "Error modifying flags file \"%s\": %s\n",
-		 flagsfn, g_strerror (errno));
+    if (io_write_typed (flags, DST_I32, ntowrite, buf, &err)) {
+	fprintf (stderr, "Error modifying \"flags\" item: %s\n", err->message);
 	return 1;
     }
 
-    if (fclose (flags)) {
-	fprintf (stderr, "Error closing flags file \"%s\": %s\n",
-		 flagsfn, g_strerror (errno));
+    if (io_close_and_free (flags, &err)) {
+	fprintf (stderr, "Error closing \"flags\" item: %s\n", err->message);
+	return 1;
+    }
+
+    if (ds_close (vis, &err)) {
+	fprintf (stderr, "Error closing dataset \"%s\": %s\n", argv[1], err->message);
 	return 1;
     }
 
-    g_free (flagsfn);
     return 0;
 }
@@ -12,9 +12,6 @@ main (int argc, char **argv)
     UVEntryType uvet;
     UVVariable *var;
     gpointer uvdata;
-#ifndef SILENT
-    gchar *buf;
-#endif
     GError *err = NULL;
     guint nrec = 0;
 
@@ -30,7 +27,7 @@ main (int argc, char **argv)
     }
 
     uvio = uvio_alloc ();
-    if (uvio_open (uvio, ds, IO_MODE_READ, 0, &err)) {
+    if (uvio_open (uvio, ds, IO_MODE_READ, DS_OFLAGS_MMAP, &err)) {
 	fprintf (stderr, "Error opening UV stream of dataset \"%s\": %s\n",
 		 argv[1], err->message);
 	return 1;
@@ -53,9 +50,13 @@ main (int argc, char **argv)
 	case UVET_DATA:
 	    var = (UVVariable *) uvdata;
 #ifndef SILENT
-	    buf = ds_type_format (var->data, var->type, var->nvals);
-	    printf ("%s.data = %s\n", var->name, buf);
-	    g_free (buf);
+	    printf ("%s.data = ", var->name);
+	    if (ds_format_values_to_file (stdout, var->data, var->type,
+					  var->nvals, DS_FORMAT_PLAIN, &err)) {
+		fprintf (stderr, "Error writing values: %s\n", err->message);
+		return 1;
+	    }
+	    putchar ('\n');
 #endif
 	    break;
 	case UVET_EOR:
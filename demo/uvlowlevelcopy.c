@@ -28,7 +28,8 @@ main (int argc, char **argv)
     }
 
     uvin = uvio_alloc ();
-    if (uvio_open (uvin, dsin, IO_MODE_READ, 0, &err)) {
+    if (uvio_open (uvin, dsin, IO_MODE_READ, DS_OFLAGS_READAHEAD | DS_OFLAGS_DIRECT,
+		   &err)) {
 	fprintf (stderr, "Error opening UV stream of dataset \"%s\" for reading: %s\n",
 		 argv[1], err->message);
 	return 1;
@@ -45,7 +46,7 @@ main (int argc, char **argv)
 
     uvout = uvio_alloc ();
     if (uvio_open (uvout, dsout, IO_MODE_WRITE,
-		   DS_OFLAGS_CREATE_OK | DS_OFLAGS_APPEND, &err)) {
+		   DS_OFLAGS_CREATE_OK | DS_OFLAGS_APPEND | DS_OFLAGS_DIRECT, &err)) {
 	fprintf (stderr, "Error opening UV stream of dataset \"%s\" for writing: %s\n",
 		 argv[2], err->message);
 	return 1;
@@ -0,0 +1,184 @@
+#include <iostream.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h> /*posix_memalign*/
+#include <string.h>
+#include <sys/mman.h>
+
+
+/* A cache of I/O buffers, so that streams opened and closed in quick
+ * succession don't keep going back to malloc() for their blocks.
+ * Buffers come in power-of-two size classes; freed buffers are kept
+ * on a per-class free list, threaded through the buffers themselves,
+ * up to a limit on the total cached. Every buffer is aligned to
+ * IO_BUF_ALIGN. Big ones come straight from mmap(), and can be backed
+ * by transparent huge pages. */
+
+#define IO_POOL_MIN_SHIFT 12 /* smallest class: 4 KiB */
+#define IO_POOL_NCLASSES 15 /* largest class: 64 MiB */
+#define IO_POOL_MMAP_SIZE (2 << 20) /* classes this big are mmapped */
+#define IO_POOL_DEFAULT_LIMIT (64 << 20)
+
+static GMutex pool_lock;
+static gpointer pool_free[IO_POOL_NCLASSES];
+static gsize pool_cached = 0;
+static gsize pool_limit = IO_POOL_DEFAULT_LIMIT;
+static gboolean pool_huge = FALSE;
+
+
+static gint
+_io_pool_class (gsize size)
+{
+    gint c = 0;
+
+    while (c < IO_POOL_NCLASSES && ((gsize) 1 << (c + IO_POOL_MIN_SHIFT)) < size)
+	c++;
+
+    return c < IO_POOL_NCLASSES ? c : -1;
+}
+
+
+static gpointer
+_io_pool_raw_alloc (gsize size)
+{
+    gpointer buf;
+
+    if (size >= IO_POOL_MMAP_SIZE) {
+	buf = mmap (NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (buf == MAP_FAILED)
+	    g_error ("Failed to map %" G_GSIZE_FORMAT " bytes", size);
+
+#ifdef MADV_HUGEPAGE
+	if (pool_huge)
+	    /* Purely advisory, so ignore failures. */
+	    madvise (buf, size, MADV_HUGEPAGE);
+#endif
+
+	return buf;
+    }
+
+    if (posix_memalign (&buf, IO_BUF_ALIGN, size))
+	g_error ("Failed to allocate %" G_GSIZE_FORMAT " aligned bytes", size);
+
+    return buf;
+}
+
+
+static void
+_io_pool_raw_free (gpointer buf, gsize size)
+{
+    if (size >= IO_POOL_MMAP_SIZE)
+	munmap (buf, size);
+    else
+	free (buf);
+}
+
+
+gpointer
+io_buf_alloc (gsize size)
+{
+    gpointer buf = NULL;
+    gint c;
+
+    g_assert (size > 0);
+
+    if ((c = _io_pool_class (size)) < 0)
+	/* Too big to be worth caching. */
+	return _io_pool_raw_alloc (size);
+
+    size = (gsize) 1 << (c + IO_POOL_MIN_SHIFT);
+
+    g_mutex_lock (&pool_lock);
+
+    if ((buf = pool_free[c]) != NULL) {
+	pool_free[c] = *((gpointer *) buf);
+	pool_cached -= size;
+    }
+
+    g_mutex_unlock (&pool_lock);
+
+    if (buf == NULL)
+	buf = _io_pool_raw_alloc (size);
+
+    return buf;
+}
+
+
+void
+io_buf_free (gpointer buf, gsize size)
+{
+    gint c;
+
+    /* @size must be what the buffer was allocated with. */
+
+    if (buf == NULL)
+	return;
+
+    if ((c = _io_pool_class (size)) < 0) {
+	_io_pool_raw_free (buf, size);
+	return;
+    }
+
+    size = (gsize) 1 << (c + IO_POOL_MIN_SHIFT);
+
+    g_mutex_lock (&pool_lock);
+
+    if (pool_cached + size <= pool_limit) {
+	*((gpointer *) buf) = pool_free[c];
+	pool_free[c] = buf;
+	pool_cached += size;
+	buf = NULL;
+    }
+
+    g_mutex_unlock (&pool_lock);
+
+    if (buf != NULL)
+	_io_pool_raw_free (buf, size);
+}
+
+
+void
+io_buf_pool_trim (void)
+{
+    gpointer lists[IO_POOL_NCLASSES], buf;
+    gint c;
+
+    /* Give everything cached back to the system. */
+
+    g_mutex_lock (&pool_lock);
+    memcpy (lists, pool_free, sizeof (lists));
+    memset (pool_free, 0, sizeof (pool_free));
+    pool_cached = 0;
+    g_mutex_unlock (&pool_lock);
+
+    for (c = 0; c < IO_POOL_NCLASSES; c++) {
+	while ((buf = lists[c]) != NULL) {
+	    lists[c] = *((gpointer *) buf);
+	    _io_pool_raw_free (buf, (gsize) 1 << (c + IO_POOL_MIN_SHIFT));
+	}
+    }
+}
+
+
+void
+io_buf_pool_configure (gsize max_cached, gboolean huge_pages)
+{
+    gboolean trim;
+
+    /* Only affects buffers allocated from here on, except that
+     * anything cached beyond the new limit is released. */
+
+    g_mutex_lock (&pool_lock);
+    pool_limit = max_cached;
+    pool_huge = huge_pages;
+    trim = (pool_cached > max_cached);
+    g_mutex_unlock (&pool_lock);
+
+    if (trim)
+	io_buf_pool_trim ();
+}
@@ -11,7 +11,9 @@
 #include <errno.h>
 #include <unistd.h>
 #include <ctype.h> /*isprint etc*/
-#include <stdio.h> /*rename*/
+#include <stdio.h> /*renameat*/
+#include <dirent.h>
+#include <sys/mman.h>
 
 /* Note that these limits are set by the file format and MUST NOT be
  * changed by the user. Doing so will break compatibility with the
@@ -21,14 +23,48 @@
 #define DS_HEADER_RECSIZE 16 /* bytes */
 #define DS_HEADER_MAXDSIZE 64 /* bytes */
 
-struct _Dataset {
-    gsize  namelen;
-    gchar *namebuf;
-    IOMode mode;
-    DSOpenFlags oflags;
-    GHashTable *small_items;
-    gboolean header_dirty;
-};
+/* Not format-related: the number of blocks that DS_OFLAGS_READAHEAD,
+ * DS_OFLAGS_URING and DS_OFLAGS_WRITEBEHIND keep in flight. */
+
+#define DS_READAHEAD_NBLOCKS 3
+#define DS_URING_NBLOCKS 4
+#define DS_WRITEBEHIND_NBLOCKS 4
+
+/* The block size used with DS_OFLAGS_DIRECT, large enough that the
+ * lack of kernel read-ahead and write-behind doesn't hurt. */
+
+#define DS_DIRECT_BUFSZ (1 << 20)
+
+/* Small items whose values change but whose type and size don't are
+ * updated by patching the header file in place. The patch is one
+ * write within one sector, which neither a crash on ordinary disks
+ * nor a concurrent reader can see half done; changes spread any wider
+ * get a full rewrite instead. */
+
+#define DS_PATCH_SECTOR 512
+
+/* The item metadata cache. Its sidecar file has a name too long to
+ * be mistaken for an item. Files modified more recently than
+ * DS_CACHE_SETTLE_NS ago aren't cached, since a second change within
+ * the filesystem's timestamp granularity would go unnoticed. */
+
+#define DS_CACHE_SIDECAR ".viskit-cache"
+#define DS_CACHE_MAGIC "VKITEMC1"
+#define DS_CACHE_SETTLE_NS G_GINT64_CONSTANT (2000000000)
+
+typedef struct _DSFileStamp {
+    guint64 ino;
+    gint64 size;
+    gint64 mtime; /* nanoseconds */
+} DSFileStamp;
+
+typedef struct _DSCachedItem {
+    gchar name[DS_ITEMNAME_MAXLEN + 1];
+    gboolean probed; /* whether type and nvals are known */
+    DSType type;
+    gsize nvals;
+    DSFileStamp stamp;
+} DSCachedItem;
 
 typedef struct _DSHeaderItem {
     /* no padding to 64-bit alignment */
@@ -40,6 +76,8 @@ typedef struct _DSSmallItem {
     gchar name[9];
     DSType type;
     gsize nvals;
+    gint32 hofs; /* offset of the values in the header file, or -1 */
+    gboolean stale; /* value differs from the one at hofs */
     union {
 	gint8 i8[64];
 	gint16 i16[32];
@@ -53,6 +91,48 @@ typedef struct _DSSmallItem {
 
 #define DSI_DATA(small) ((gpointer) small->vals.i8)
 
+/* The small items live in one array, in the order they were read or
+ * added, with an open-addressing index over it: each slot holds 0 if
+ * it's empty, or one more than the index of an item in the array.
+ * Items are never removed, so the index doesn't need tombstones. */
+
+typedef struct _DSSmallTable {
+    DSSmallItem *items;
+    guint nitems;
+    guint nalloc;
+    guint32 *slots;
+    guint nslots; /* a power of two, at least twice nitems */
+} DSSmallTable;
+
+struct _Dataset {
+    /* Fixed once the dataset is open. */
+    gchar *name; /* for messages; items are reached through dirfd */
+    int dirfd;
+    IOMode mode;
+    DSOpenFlags oflags;
+
+    /* Everything else is guarded by the lock, so that a dataset can be
+     * shared between threads. It's recursive since the public
+     * functions call each other. */
+    GRecMutex lock;
+    DSSmallTable small_items;
+    gboolean header_loaded; /* small_items reflects the header file */
+    gboolean header_dirty;
+    gboolean header_relayout; /* it needs rewriting, not just patching */
+    DSFileStamp header_stamp; /* the header file that hofs refer to */
+    GError *header_err; /* why the last attempt to load it failed */
+    IOAccessHint hint; /* for items without their own */
+    gboolean hint_set; /* has hint been set explicitly? */
+    GHashTable *item_hints; /* item name -> IOAccessHint; may be NULL */
+    GHashTable *item_cache; /* large item name -> DSCachedItem; may be NULL */
+    gboolean list_cached; /* item_cache holds every large item ... */
+    DSFileStamp dir_stamp; /* ... as of this directory stamp */
+    gboolean cache_dirty;
+    gint durability; /* a DSDurability; atomic, so not under the lock */
+    guint batch_depth;
+    GSList *batch_replaced; /* items whose replacements await the commit */
+};
+
 static IOStream *_ds_open_large_item_full (Dataset *ds, const gchar *name,
 					   IOMode mode, DSOpenFlags flags,
 					   gboolean trunc_ok, gboolean check_name,
@@ -83,26 +163,308 @@ ds_error_describe (DSError error)
 	return "illegal item name";
     case DS_ERROR_NONEXISTANT:
 	return "does not exist";
+    case DS_ERROR_IO:
+	return "I/O error";
     default:
 	return "unknown error";
     }
 }
 
 
-void
-_ds_set_name_dir (Dataset *ds)
+/* Items are always accessed relative to the dataset's directory fd,
+ * so there's no path to rebuild and walk for each item, and the
+ * dataset keeps working if its parent directories are renamed. */
+
+static DIR *
+_ds_open_dir (Dataset *ds, GError **err)
 {
-    ds->namebuf[ds->namelen] = '\0';
+    DIR *dir;
+    int fd;
+
+    /* fdopendir() takes ownership of its fd, and we want to keep
+     * ours, so hand it a duplicate. It shares our file position, so
+     * rewind it. */
+
+    if ((fd = dup (ds->dirfd)) < 0) {
+	IO_ERRNO_ERRV (err, errno, "Failed to read dataset directory \"%s\"",
+		       ds->name);
+	return NULL;
+    }
+
+    if ((dir = fdopendir (fd)) == NULL) {
+	IO_ERRNO_ERRV (err, errno, "Failed to read dataset directory \"%s\"",
+		       ds->name);
+	close (fd);
+	return NULL;
+    }
+
+    rewinddir (dir);
+    return dir;
 }
 
-void
-_ds_set_name_item (Dataset *ds, const char *item)
+
+static const gchar *
+_ds_read_dir (DIR *dir)
+{
+    struct dirent *ent;
+
+    while ((ent = readdir (dir)) != NULL)
+	if (strcmp (ent->d_name, ".") != 0 && strcmp (ent->d_name, "..") != 0)
+	    return ent->d_name;
+
+    return NULL;
+}
+
+
+/* The item metadata cache. The caller must hold the dataset lock for
+ * all of the _ds_cache functions. With it, probing an item whose size,
+ * mtime and inode haven't changed takes a single stat(), and listing
+ * the items of a directory that hasn't changed takes none. With
+ * DS_OFLAGS_ITEM_CACHE, it's loaded from and saved to a sidecar file
+ * in the dataset, so that it carries over between runs. */
+
+typedef struct _DSCacheHeader {
+    gchar magic[8];
+    guint32 nrecs;
+    guint32 list_cached;
+    DSFileStamp dir_stamp;
+} DSCacheHeader;
+
+typedef struct _DSCacheRecord {
+    gchar name[DS_ITEMNAME_MAXLEN + 1];
+    guint8 probed;
+    guint8 pad[2];
+    gint32 type;
+    guint64 nvals;
+    DSFileStamp stamp;
+} DSCacheRecord;
+
+
+static void
+_ds_stamp (const struct stat *st, DSFileStamp *stamp)
 {
-    /* It's assumed here that we've sanitychecked
-     * that @item is less than 8 characters long. */
+    stamp->ino = st->st_ino;
+    stamp->size = st->st_size;
+    stamp->mtime = (gint64) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
 
-    ds->namebuf[ds->namelen] = '/';
-    strcpy (ds->namebuf + ds->namelen + 1, item);
+
+static gboolean
+_ds_stamp_equal (const DSFileStamp *a, const DSFileStamp *b)
+{
+    return a->ino == b->ino && a->size == b->size && a->mtime == b->mtime;
+}
+
+
+static gboolean
+_ds_stamp_settled (const DSFileStamp *stamp)
+{
+    return stamp->mtime < g_get_real_time () * 1000 - DS_CACHE_SETTLE_NS;
+}
+
+
+static DSCachedItem *
+_ds_cache_get (Dataset *ds, const gchar *name, gboolean create)
+{
+    DSCachedItem *ci = NULL;
+
+    if (ds->item_cache != NULL)
+	ci = g_hash_table_lookup (ds->item_cache, name);
+
+    if (ci != NULL || !create)
+	return ci;
+
+    if (ds->item_cache == NULL)
+	ds->item_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+						NULL, g_free);
+
+    ci = g_new0 (DSCachedItem, 1);
+    g_strlcpy (ci->name, name, sizeof (ci->name));
+    g_hash_table_insert (ds->item_cache, ci->name, ci);
+    return ci;
+}
+
+
+static void
+_ds_cache_forget (Dataset *ds, const gchar *name)
+{
+    DSCachedItem *ci;
+
+    /* The item is being modified. It stays listed, since it's still
+     * in the directory (and if it isn't, the directory stamp will
+     * have changed). */
+
+    if ((ci = _ds_cache_get (ds, name, FALSE)) != NULL && ci->probed) {
+	ci->probed = FALSE;
+	ds->cache_dirty = TRUE;
+    }
+}
+
+
+static void
+_ds_cache_clear (Dataset *ds)
+{
+    if (ds->item_cache != NULL) {
+	g_hash_table_destroy (ds->item_cache);
+	ds->item_cache = NULL;
+    }
+
+    ds->list_cached = FALSE;
+    ds->cache_dirty = TRUE;
+}
+
+
+static guint32
+_ds_cache_checksum (const gchar *data, gsize len)
+{
+    guint32 h = 2166136261u; /* FNV-1a */
+
+    while (len-- > 0)
+	h = (h ^ (guint8) *data++) * 16777619u;
+
+    return h;
+}
+
+
+static void
+_ds_cache_load (Dataset *ds)
+{
+    gchar *contents = NULL;
+    gsize len, i;
+    gssize n;
+    DSCacheHeader hdr;
+    struct stat statbuf;
+    guint32 sum;
+    int fd;
+
+    /* The sidecar is purely an optimization, so if it's missing,
+     * unreadable or damaged, we just start from scratch. It's in host
+     * byte order; a foreign one fails the checks. */
+
+    if ((fd = openat (ds->dirfd, DS_CACHE_SIDECAR, O_RDONLY | O_CLOEXEC)) < 0)
+	return;
+
+    if (fstat (fd, &statbuf) || statbuf.st_size < sizeof (hdr) + sizeof (sum)) {
+	close (fd);
+	return;
+    }
+
+    len = statbuf.st_size;
+    contents = g_malloc (len);
+
+    do
+	n = pread (fd, contents, len, 0);
+    while (n < 0 && errno == EINTR);
+
+    close (fd);
+
+    if (n != len)
+	goto done;
+
+    memcpy (&hdr, contents, sizeof (hdr));
+    memcpy (&sum, contents + len - sizeof (sum), sizeof (sum));
+
+    if (memcmp (hdr.magic, DS_CACHE_MAGIC, sizeof (hdr.magic)) != 0 ||
+	len != sizeof (hdr) + hdr.nrecs * sizeof (DSCacheRecord) + sizeof (sum) ||
+	sum != _ds_cache_checksum (contents, len - sizeof (sum)))
+	goto done;
+
+    _ds_cache_clear (ds);
+
+    for (i = 0; i < hdr.nrecs; i++) {
+	DSCacheRecord rec;
+	DSCachedItem *ci;
+
+	memcpy (&rec, contents + sizeof (hdr) + i * sizeof (rec), sizeof (rec));
+
+	if (rec.name[DS_ITEMNAME_MAXLEN] != '\0' || rec.name[0] == '\0' ||
+	    (rec.probed && !DST_VALID (rec.type))) {
+	    _ds_cache_clear (ds);
+	    goto done;
+	}
+
+	ci = _ds_cache_get (ds, rec.name, TRUE);
+	ci->probed = rec.probed;
+	ci->type = (DSType) rec.type;
+	ci->nvals = rec.nvals;
+	ci->stamp = rec.stamp;
+    }
+
+    ds->list_cached = hdr.list_cached;
+    ds->dir_stamp = hdr.dir_stamp;
+    ds->cache_dirty = FALSE;
+
+done:
+    g_free (contents);
+}
+
+
+static void
+_ds_cache_save (Dataset *ds)
+{
+    GHashTableIter hiter;
+    DSCachedItem *ci;
+    DSCacheHeader hdr;
+    DSCacheRecord *recs;
+    gchar *buf;
+    guint32 sum;
+    gsize len, ofs = 0;
+    int fd;
+
+    /* Failures here are ignored; the dataset may well be read-only to
+     * us. The file is overwritten in place rather than replaced, so
+     * that once it exists, saving it doesn't change the directory
+     * stamp. A reader racing with us fails the checksum. */
+
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, DS_CACHE_MAGIC, sizeof (hdr.magic));
+    hdr.list_cached = ds->list_cached;
+    hdr.dir_stamp = ds->dir_stamp;
+    hdr.nrecs = ds->item_cache ? g_hash_table_size (ds->item_cache) : 0;
+
+    len = sizeof (hdr) + hdr.nrecs * sizeof (DSCacheRecord) + sizeof (sum);
+    buf = g_malloc0 (len);
+    memcpy (buf, &hdr, sizeof (hdr));
+    recs = (DSCacheRecord *) (buf + sizeof (hdr));
+
+    if (ds->item_cache != NULL) {
+	g_hash_table_iter_init (&hiter, ds->item_cache);
+
+	while (g_hash_table_iter_next (&hiter, NULL, (gpointer *) &ci)) {
+	    strcpy (recs->name, ci->name);
+	    recs->probed = ci->probed;
+	    recs->type = ci->type;
+	    recs->nvals = ci->nvals;
+	    recs->stamp = ci->stamp;
+	    recs++;
+	}
+    }
+
+    sum = _ds_cache_checksum (buf, len - sizeof (sum));
+    memcpy (buf + len - sizeof (sum), &sum, sizeof (sum));
+
+    if ((fd = openat (ds->dirfd, DS_CACHE_SIDECAR,
+		      O_WRONLY | O_CREAT | O_CLOEXEC, 0644)) < 0)
+	goto done;
+
+    while (ofs < len) {
+	gssize n = write (fd, buf + ofs, len - ofs);
+
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0)
+	    break;
+
+	ofs += n;
+    }
+
+    if (ofs == len && ftruncate (fd, len) == 0)
+	ds->cache_dirty = FALSE;
+
+    close (fd);
+
+done:
+    g_free (buf);
 }
 
 
@@ -110,68 +472,166 @@ static gboolean
 _ds_truncate (Dataset *ds, GError **err)
 {
     gboolean retval = TRUE;
-    GDir *dir;
+    DIR *dir;
     const gchar *diritem;
 
-    _ds_set_name_dir (ds);
-
-    if ((dir = g_dir_open (ds->namebuf, 0, err)) == NULL)
+    if ((dir = _ds_open_dir (ds, err)) == NULL)
 	return TRUE;
 
-    while ((diritem = g_dir_read_name (dir)) != NULL) {
-	gchar *full = g_strdup_printf ("%s/%s", ds->namebuf, diritem);
-
-	if (unlink (full)) {
-	    IO_ERRNO_ERRV (err, errno, "Failed to unlink item file \"%s\"",
-			   full);
-	    g_free (full);
+    while ((diritem = _ds_read_dir (dir)) != NULL) {
+	if (unlinkat (ds->dirfd, diritem, 0)) {
+	    IO_ERRNO_ERRV (err, errno, "Failed to unlink item file \"%s/%s\"",
+			   ds->name, diritem);
 	    goto bail;
 	}
-
-	g_free (full);
     }
 
     retval = FALSE;
 bail:
-    g_dir_close (dir);
+    closedir (dir);
+    _ds_cache_clear (ds);
     return retval;
 }
 
 
+static guint32
+_ds_small_hash (const gchar *name)
+{
+    guint32 h = 2166136261u; /* FNV-1a */
+
+    while (*name)
+	h = (h ^ (guint8) *name++) * 16777619u;
+
+    return h;
+}
+
+
+static guint32 *
+_ds_small_slot (DSSmallTable *st, const gchar *name)
+{
+    guint mask = st->nslots - 1;
+    guint i = _ds_small_hash (name) & mask;
+
+    /* There's always an empty slot, so this terminates. */
+
+    while (st->slots[i] != 0 &&
+	   strcmp (st->items[st->slots[i] - 1].name, name) != 0)
+	i = (i + 1) & mask;
+
+    return &st->slots[i];
+}
+
+
+static void
+_ds_small_reserve (DSSmallTable *st, guint nitems)
+{
+    guint i, nslots;
+
+    if (nitems > st->nalloc) {
+	st->nalloc = MAX (nitems, 2 * st->nalloc);
+	st->items = g_renew (DSSmallItem, st->items, st->nalloc);
+    }
+
+    for (nslots = MAX (st->nslots, 16); nslots < 2 * nitems; nslots *= 2)
+	;
+
+    if (nslots == st->nslots)
+	return;
+
+    g_free (st->slots);
+    st->slots = g_new0 (guint32, nslots);
+    st->nslots = nslots;
+
+    for (i = 0; i < st->nitems; i++)
+	*_ds_small_slot (st, st->items[i].name) = i + 1;
+}
+
+
+static DSSmallItem *
+_ds_small_lookup (DSSmallTable *st, const gchar *name)
+{
+    guint32 idx;
+
+    if (st->nitems == 0)
+	return NULL;
+
+    if ((idx = *_ds_small_slot (st, name)) == 0)
+	return NULL;
+
+    return &st->items[idx - 1];
+}
+
+
+/* Returns the item named @name, adding a zeroed one if there isn't
+ * one. The pointer is good until the next item is added. */
+
+static DSSmallItem *
+_ds_small_insert (DSSmallTable *st, const gchar *name)
+{
+    DSSmallItem *si;
+    guint32 *slot;
+
+    _ds_small_reserve (st, st->nitems + 1);
+
+    if (*(slot = _ds_small_slot (st, name)) != 0)
+	return &st->items[*slot - 1];
+
+    si = &st->items[st->nitems++];
+    memset (si, 0, sizeof (*si));
+    strcpy (si->name, name);
+    si->hofs = -1;
+    *slot = st->nitems;
+    return si;
+}
+
+
+static void
+_ds_small_clear (DSSmallTable *st)
+{
+    g_free (st->items);
+    g_free (st->slots);
+    memset (st, 0, sizeof (*st));
+}
+
+
+/* The header is read by mapping it and walking the records in place,
+ * so the only allocations are the small-item array and its index,
+ * both sized up front: a record with data takes at least two
+ * DS_HEADER_RECSIZE units, which bounds the number of items. */
+
 static gboolean
-_ds_read_header (Dataset *ds, GError **err)
+_ds_parse_header (Dataset *ds, const gchar *buf, gsize size, GError **err)
 {
-    gboolean retval = TRUE;
-    IOStream *hio;
-    GError *suberr;
-    gsize nread;
-    DSHeaderItem *hitem;
+    gsize pos = 0;
 
-    if ((hio = ds_open_large_item (ds, "header", IO_MODE_READ, 0, err)) == NULL)
-	goto bail;
+    _ds_small_reserve (&ds->small_items, size / (2 * DS_HEADER_RECSIZE));
 
-    while ((nread = io_read_into_temp_buf (hio, DS_HEADER_RECSIZE,
-					   (gpointer *) &hitem, &suberr)) > 0) {
-	gchar *data;
-	gsize ndata;
+    while (pos < size) {
+	const DSHeaderItem *hitem;
+	const gchar *data;
 	DSSmallItem *si;
+	DSType type;
+	guint8 align;
 
-	if (nread != DS_HEADER_RECSIZE) {
-	    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT, 
+	if (size - pos < DS_HEADER_RECSIZE) {
+	    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
 			 "Invalid dataset header: incomplete record");
-	    goto bail;
+	    return TRUE;
 	}
 
+	hitem = (const DSHeaderItem *) (buf + pos);
+	pos += DS_HEADER_RECSIZE;
+
 	if (hitem->alen < 5 && hitem->alen != 0) {
 	    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
 			 "Invalid dataset header: bad record length");
-	    goto bail;
+	    return TRUE;
 	}
 
 	if (hitem->alen > DS_HEADER_MAXDSIZE) {
 	    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
 			 "Invalid dataset header: record len > MAXDSIZE");
-	    goto bail;
+	    return TRUE;
 	}
 
 	/* DS_ITEMNAME_MAXLEN is > DS_HEADER_RECSIZE - 1, and the
@@ -182,79 +642,156 @@ _ds_read_header (Dataset *ds, GError **err)
 	if (hitem->name[DS_ITEMNAME_MAXLEN] != '\0') {
 	    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
 			 "Invalid dataset header: non NUL-terminated item name");
-	    goto bail;
+	    return TRUE;
 	}
 
-	si = g_new0 (DSSmallItem, 1);
-	strcpy (si->name, hitem->name);
+	if (hitem->alen == 0)
+	    /* No data for this item, so nothing to keep. */
+	    continue;
 
-	if (hitem->alen == 0) {
-	    /* No data for this item. */
-	    si->type = DST_BIN;
-	    si->nvals = 0;
-	} else {
-	    guint8 align;
-	    gsize dlen;
+	if (size - pos < (gsize) hitem->alen) {
+	    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
+			 "Invalid dataset header: incomplete small item");
+	    return TRUE;
+	}
 
-	    ndata = io_read_into_temp_buf (hio, hitem->alen, (gpointer *) &data,
-					   &suberr);
+	data = buf + pos;
+	type = IO_RECODE_I32 (data);
 
-	    if (ndata < 0) {
-		g_propagate_error (err, suberr);
-		goto bail;
-	    }
+	if (!DST_VALID (type)) {
+	    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
+			 "Invalid dataset header: illegal type code 0x%x", type);
+	    return TRUE;
+	}
 
-	    if (ndata != hitem->alen) {
-		g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
-			     "Invalid dataset header: incomplete small item");
-		goto bail;
-	    }
+	/* The header-writing code aligns based on the type sizes,
+	 * not the type alignment values (which is relevant for
+	 * complex-valued headers) */
 
-	    si->type = IO_RECODE_I32 (data);
+	align = MAX (4, ds_type_sizes[type]);
 
-	    if (!DST_VALID (si->type)) {
-		g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
-			     "Invalid dataset header: illegal type code 0x%x", si->type);
-		goto bail;
-	    }
+	if (hitem->alen < align ||
+	    (hitem->alen - align) % ds_type_sizes[type] != 0) {
+	    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
+			 "Invalid dataset header: nonintegral number of values");
+	    return TRUE;
+	}
 
-	    /* The header-writing code aligns based on the type sizes,
-	     * not the type alignment values (which is relevant for
-	     * complex-valued headers) */
+	si = _ds_small_insert (&ds->small_items, hitem->name);
+	si->type = type;
+	si->nvals = (hitem->alen - align) / ds_type_sizes[type];
+	io_recode_data_copy (data + align, si->vals.text, type, si->nvals);
 
-	    align = MAX (4, ds_type_sizes[si->type]);
-	    data += align;
-	    dlen = hitem->alen - align;
+	/* The writer pads complex values differently from how we read
+	 * them, so those always take a full rewrite. */
 
-	    if (dlen % ds_type_sizes[si->type] != 0) {
-		g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
-			     "Invalid dataset header: nonintegral number of values");
-		goto bail;
-	    }
+	if (ds_type_sizes[type] == ds_type_aligns[type])
+	    si->hofs = pos + align;
 
-	    si->nvals = dlen / ds_type_sizes[si->type];
-	    io_recode_data_copy (data, si->vals.text, si->type, si->nvals);
-	    g_hash_table_insert (ds->small_items, si->name, si);
-	}
+	/* On to the next record boundary, which the last record's
+	 * padding may stop short of. */
 
-	if (io_nudge_align (hio, DS_HEADER_RECSIZE, &suberr)) {
-	    g_propagate_error (err, suberr);
-	    goto bail;
-	}
+	pos += hitem->alen;
+	pos = MIN (size, (pos + DS_HEADER_RECSIZE - 1) & ~(gsize) (DS_HEADER_RECSIZE - 1));
     }
 
-    retval = FALSE;
-bail:
-    if (io_close_and_free (hio, err))
+    return FALSE;
+}
+
+
+static gboolean
+_ds_read_header (Dataset *ds, GError **err)
+{
+    gboolean retval;
+    struct stat statbuf;
+    gpointer map;
+    int fd;
+
+    if ((fd = openat (ds->dirfd, "header", O_RDONLY | O_CLOEXEC)) < 0) {
+	IO_ERRNO_ERRV (err, errno, "Failed to open item file \"%s/header\"",
+		       ds->name);
+	return TRUE;
+    }
+
+    if (fstat (fd, &statbuf)) {
+	IO_ERRNO_ERRV (err, errno, "Unable to stat dataset item \"%s/header\"",
+		       ds->name);
+	close (fd);
+	return TRUE;
+    }
+
+    _ds_stamp (&statbuf, &ds->header_stamp);
+
+    if (statbuf.st_size == 0) {
+	close (fd);
+	return FALSE;
+    }
+
+    map = mmap (NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+
+    if (map == MAP_FAILED) {
+	IO_ERRNO_ERRV (err, errno, "Failed to map dataset item \"%s/header\"",
+		       ds->name);
+	return TRUE;
+    }
+
+    retval = _ds_parse_header (ds, map, statbuf.st_size, err);
+    munmap (map, statbuf.st_size);
+    return retval;
+}
+
+
+/* The header is read the first time that anything needs the small
+ * items, unless DS_OFLAGS_EAGER_HEADER asks for it at open. If it
+ * can't be read, we try again next time. Call with the lock held. */
+
+static gboolean
+_ds_load_header (Dataset *ds, GError **err)
+{
+    if (ds->header_loaded)
+	return FALSE;
+
+    /* Keep the reason for any failure, for callers that can't report
+     * it themselves; see ds_get_header_error(). */
+
+    g_clear_error (&ds->header_err);
+
+    if (_ds_read_header (ds, &ds->header_err)) {
+	_ds_small_clear (&ds->small_items);
+	if (err != NULL)
+	    g_propagate_error (err, g_error_copy (ds->header_err));
+	return TRUE;
+    }
+
+    ds->header_loaded = TRUE;
+    return FALSE;
+}
+
+
+gboolean
+ds_get_header_error (Dataset *ds, GError **err)
+{
+    gboolean retval = FALSE;
+
+    g_rec_mutex_lock (&ds->lock);
+
+    if (!ds->header_loaded && ds->header_err != NULL) {
+	g_propagate_error (err, g_error_copy (ds->header_err));
 	retval = TRUE;
+    }
+
+    g_rec_mutex_unlock (&ds->lock);
     return retval;
 }
 
+
 Dataset *
 ds_open (const char *filename, IOMode mode, DSOpenFlags flags, GError **err)
 {
     Dataset *ds;
     gboolean created = FALSE;
+    int dirfd;
 
     g_return_val_if_fail (filename != NULL, NULL);
     g_return_val_if_fail (mode != IO_MODE_READ_WRITE, NULL);
@@ -282,39 +819,55 @@ ds_open (const char *filename, IOMode mode, DSOpenFlags flags, GError **err)
 		return NULL;
 	    }
 	}
-    } else {
-	/* This isn't a fully comprehensive test, and as always it is
-	 * subject to races. We'll have a better idea of whether this
-	 * DS is ok when we try to read in the header. */
+    }
 
-	if (!g_file_test (filename, G_FILE_TEST_IS_DIR)) {
+    /* We'll have a better idea of whether this DS is ok when we try
+     * to read in the header. */
+
+    if ((dirfd = open (filename, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+	if (errno == ENOENT || errno == ENOTDIR)
 	    g_set_error (err, G_FILE_ERROR, G_FILE_ERROR_NOTDIR,
 			 "Cannot open the dataset \"%s\" since it "
 			 "does not exist or is not a directory.", filename);
-	    return NULL;
-	}
+	else
+	    IO_ERRNO_ERRV (err, errno, "Couldn't open dataset directory \"%s\"",
+			   filename);
+	return NULL;
     }
 
     ds = g_new0 (Dataset, 1);
-    ds->namelen = strlen (filename);
-    /* The + 8 is padding to allow for temporary illegal item names when,
-     * e.g., rewriting certain items. */
-    ds->namebuf = g_new (gchar, ds->namelen + DS_ITEMNAME_MAXLEN + 2 + 8);
-    strcpy (ds->namebuf, filename);
+    g_rec_mutex_init (&ds->lock);
+    ds->name = g_strdup (filename);
+    ds->dirfd = dirfd;
     ds->mode = mode;
     ds->oflags = flags;
     ds->header_dirty = created; /* Write blank header if creating dset */
-    ds->small_items = g_hash_table_new_full (g_str_hash,
-					     g_str_equal,
-					     NULL, g_free);
+    ds->header_relayout = created;
+    ds->header_loaded = created;
 
     if (!created) {
 	if ((mode & IO_MODE_WRITE) && (flags & DS_OFLAGS_TRUNCATE)) {
 	    if (_ds_truncate (ds, err))
 		goto bail;
+
+	    ds->header_loaded = TRUE;
+	    ds->header_relayout = TRUE;
 	} else {
-	    if (_ds_read_header (ds, err))
+	    /* Unless we're asked to read the header now, just check
+	     * that there is one, so that opening something that isn't
+	     * a dataset still fails. */
+
+	    if (flags & DS_OFLAGS_EAGER_HEADER) {
+		if (_ds_load_header (ds, err))
+		    goto bail;
+	    } else if (faccessat (ds->dirfd, "header", F_OK, 0)) {
+		IO_ERRNO_ERRV (err, errno, "Failed to open item file "
+			       "\"%s/header\"", ds->name);
 		goto bail;
+	    }
+
+	    if (flags & DS_OFLAGS_ITEM_CACHE)
+		_ds_cache_load (ds);
 	}
     }
 
@@ -330,7 +883,6 @@ static gboolean
 _ds_rename_large_item_full (Dataset *ds, const gchar *oldname, const gchar *newname,
 			    gboolean check_new_name, GError **err)
 {
-    gchar *oldpath, *newpath;
     gboolean retval = FALSE;
 
     g_assert (ds->mode & IO_MODE_WRITE);
@@ -338,16 +890,16 @@ _ds_rename_large_item_full (Dataset *ds, const gchar *oldname, const gchar *newn
     if (check_new_name && !_ds_item_name_ok (newname, err))
 	return TRUE;
 
-    _ds_set_name_dir (ds);
-    oldpath = g_strdup_printf ("%s/%s", ds->namebuf, oldname);
-    newpath = g_strdup_printf ("%s/%s", ds->namebuf, newname);
-    if (rename (oldpath, newpath)) {
-	IO_ERRNO_ERRV (err, errno, "Failed to rename \"%s\" -> \"%s\"",
-		       oldpath, newpath);
+    g_rec_mutex_lock (&ds->lock);
+    _ds_cache_forget (ds, oldname);
+    _ds_cache_forget (ds, newname);
+    g_rec_mutex_unlock (&ds->lock);
+
+    if (renameat (ds->dirfd, oldname, ds->dirfd, newname)) {
+	IO_ERRNO_ERRV (err, errno, "Failed to rename \"%s/%s\" -> \"%s/%s\"",
+		       ds->name, oldname, ds->name, newname);
 	retval = TRUE;
     }
-    g_free (oldpath);
-    g_free (newpath);
     return retval;
 }
 
@@ -360,23 +912,223 @@ ds_rename_large_item (Dataset *ds, const gchar *oldname, const gchar *newname,
 }
 
 
+/* Flush an item's data to disk, for DS_DURABILITY_DATA and above.
+ * fdatasync() doesn't care that the descriptor is read-only. */
+
+static gboolean
+_ds_sync_item_fd (Dataset *ds, int fd, GError **err)
+{
+    if (g_atomic_int_get (&ds->durability) < DS_DURABILITY_DATA)
+	return FALSE;
+
+    if (fdatasync (fd)) {
+	IO_ERRNO_ERR (err, errno, "Failed to sync dataset item file");
+	return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+static gboolean
+_ds_sync_item (Dataset *ds, const gchar *name, GError **err)
+{
+    gboolean retval;
+    int fd;
+
+    if (g_atomic_int_get (&ds->durability) < DS_DURABILITY_DATA)
+	return FALSE;
+
+    if ((fd = openat (ds->dirfd, name, O_RDONLY | O_CLOEXEC)) < 0) {
+	IO_ERRNO_ERRV (err, errno, "Failed to open item file \"%s/%s\"",
+		       ds->name, name);
+	return TRUE;
+    }
+
+    if ((retval = _ds_sync_item_fd (ds, fd, NULL)))
+	IO_ERRNO_ERRV (err, errno, "Failed to sync item file \"%s/%s\"",
+		       ds->name, name);
+
+    close (fd);
+    return retval;
+}
+
+
 gboolean
-ds_write_header (Dataset *ds, GError **err)
+ds_sync_large_item (Dataset *ds, const gchar *name, GError **err)
+{
+    g_return_val_if_fail (name != NULL, TRUE);
+
+    return _ds_sync_item (ds, name, err);
+}
+
+
+/* Make renames in the dataset durable, for DS_DURABILITY_DIR. */
+
+static gboolean
+_ds_sync_dir (Dataset *ds, GError **err)
+{
+    if (g_atomic_int_get (&ds->durability) < DS_DURABILITY_DIR)
+	return FALSE;
+
+    if (fsync (ds->dirfd)) {
+	IO_ERRNO_ERRV (err, errno, "Failed to sync dataset directory \"%s\"",
+		       ds->name);
+	return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+static gboolean
+_ds_replace_large_item (Dataset *ds, const gchar *name, GError **err)
+{
+    gchar *repname;
+    gboolean retval;
+
+    repname = g_strconcat (name, "+new", NULL);
+    retval = (_ds_sync_item (ds, repname, err) ||
+	      _ds_rename_large_item_full (ds, repname, name, TRUE, err));
+    g_free (repname);
+    return retval;
+}
+
+
+/* Write the stale small items' values into the header in place.
+ * Returns TRUE if that can't be done; the caller then rewrites the
+ * whole header, which also reports any real problem. */
+
+static gboolean
+_ds_patch_header (Dataset *ds)
 {
+    struct stat statbuf;
+    DSFileStamp stamp;
+    gchar buf[DS_PATCH_SECTOR];
+    gint32 lo = -1, hi = 0;
+    gssize n;
+    guint i;
+    int fd;
+
+    if (ds->header_relayout)
+	return TRUE;
+
+    /* The range covering all the stale values, which must fit in one
+     * sector. */
+
+    for (i = 0; i < ds->small_items.nitems; i++) {
+	DSSmallItem *small = &ds->small_items.items[i];
+	gsize nbytes = small->nvals * ds_type_sizes[small->type];
+
+	if (!small->stale)
+	    continue;
+
+	if (small->hofs < 0)
+	    return TRUE;
+
+	if (lo < 0 || small->hofs < lo)
+	    lo = small->hofs;
+	hi = MAX (hi, small->hofs + (gint32) nbytes);
+    }
+
+    if (lo >= 0 && lo / DS_PATCH_SECTOR != (hi - 1) / DS_PATCH_SECTOR)
+	return TRUE;
+
+    /* Make sure that it's still the file that we know the layout of. */
+
+    if ((fd = openat (ds->dirfd, "header", O_RDWR | O_CLOEXEC)) < 0)
+	return TRUE;
+
+    if (fstat (fd, &statbuf))
+	goto bail;
+
+    _ds_stamp (&statbuf, &stamp);
+
+    if (!_ds_stamp_equal (&stamp, &ds->header_stamp))
+	goto bail;
+
+    if (lo >= 0) {
+	/* Whatever lies between the stale values is written back as it
+	 * is, so that the patch is a single write. */
+
+	do
+	    n = pread (fd, buf, hi - lo, lo);
+	while (n < 0 && errno == EINTR);
+
+	if (n != hi - lo)
+	    goto bail;
+
+	for (i = 0; i < ds->small_items.nitems; i++) {
+	    DSSmallItem *small = &ds->small_items.items[i];
+
+	    if (small->stale)
+		io_recode_data_copy (DSI_DATA (small), buf + (small->hofs - lo),
+				     small->type, small->nvals);
+	}
+
+	do
+	    n = pwrite (fd, buf, hi - lo, lo);
+	while (n < 0 && errno == EINTR);
+
+	if (n != hi - lo)
+	    goto bail;
+
+	for (i = 0; i < ds->small_items.nitems; i++)
+	    ds->small_items.items[i].stale = FALSE;
+    }
+
+    if (_ds_sync_item_fd (ds, fd, NULL) || fstat (fd, &statbuf))
+	goto bail;
+
+    _ds_stamp (&statbuf, &ds->header_stamp);
+    close (fd);
+    return FALSE;
+
+bail:
+    close (fd);
+    return TRUE;
+}
+
+
+static gboolean
+_ds_write_header (Dataset *ds, GError **err)
+{
+    struct stat statbuf;
     IOStream *hio;
-    GHashTableIter hiter;
-    DSSmallItem *small;
+    gint32 *hofs;
+    guint i;
+
+    g_assert (ds->mode & IO_MODE_WRITE);
+
+    /* Hold the lock throughout, so that the header we write is a
+     * consistent snapshot of the small items. */
 
-    g_assert (ds->mode & IO_MODE_WRITE);
+    g_rec_mutex_lock (&ds->lock);
+
+    /* Don't clobber items we haven't read yet. */
+
+    if (_ds_load_header (ds, err)) {
+	g_rec_mutex_unlock (&ds->lock);
+	return TRUE;
+    }
+
+    if (!_ds_patch_header (ds))
+	goto done;
 
     /* Write out new header alongside old one */
 
-    if ((hio = ds_open_large_item_for_replace (ds, "header", err)) == NULL)
+    if ((hio = ds_open_large_item_for_replace (ds, "header", err)) == NULL) {
+	g_rec_mutex_unlock (&ds->lock);
 	return TRUE;
+    }
 
-    g_hash_table_iter_init (&hiter, ds->small_items);
+    /* Where each value lands in the new file. These only apply once
+     * it has replaced the old one, which has a layout of its own. */
 
-    while (g_hash_table_iter_next (&hiter, (gpointer *) &small, NULL)) {
+    hofs = g_new (gint32, MAX (ds->small_items.nitems, 1));
+
+    for (i = 0; i < ds->small_items.nitems; i++) {
+	DSSmallItem *small = &ds->small_items.items[i];
 	DSHeaderItem hitem;
 	guint8 dsize;
 	gint32 typecode;
@@ -398,6 +1150,8 @@ ds_write_header (Dataset *ds, GError **err)
 	if (io_write_raw (hio, sizeof (hitem), &hitem, err))
 	    goto bail;
 
+	hofs[i] = -1;
+
 	if (dsize == 0)
 	    continue;
 
@@ -412,29 +1166,148 @@ ds_write_header (Dataset *ds, GError **err)
 	if (io_nudge_align (hio, ds_type_aligns[small->type], err))
 	    goto bail;
 
+	if (ds_type_sizes[small->type] == ds_type_aligns[small->type])
+	    hofs[i] = io_tell (hio);
+
 	if (io_write_typed (hio, small->type, small->nvals,
 			    DSI_DATA (small), err))
 	    goto bail;
     }
 
     if (io_close_and_free (hio, err))
-	return TRUE;
+	goto failed;
+
+    if (_ds_sync_item (ds, "header+new", err))
+	goto failed;
 
     /* Move it into place. Avoid ds_finish_large_item_replace since it will
      * reject the destination name "header". */
 
     if (_ds_rename_large_item_full (ds, "header+new", "header", FALSE, err))
-	return TRUE;
+	goto failed;
+
+    /* The offsets we just noted are good for patching from now on,
+     * until somebody else replaces the file. */
+
+    for (i = 0; i < ds->small_items.nitems; i++) {
+	ds->small_items.items[i].hofs = hofs[i];
+	ds->small_items.items[i].stale = FALSE;
+    }
+
+    g_free (hofs);
+
+    ds->header_relayout = FALSE;
+    memset (&ds->header_stamp, 0, sizeof (ds->header_stamp));
+
+    if (fstatat (ds->dirfd, "header", &statbuf, 0) == 0)
+	_ds_stamp (&statbuf, &ds->header_stamp);
 
+done:
     ds->header_dirty = FALSE;
+    g_rec_mutex_unlock (&ds->lock);
     return FALSE;
 
 bail:
     io_close_and_free (hio, NULL);
+failed:
+    g_free (hofs);
+    g_rec_mutex_unlock (&ds->lock);
     return TRUE;
 }
 
 
+gboolean
+ds_write_header (Dataset *ds, GError **err)
+{
+    gboolean retval = FALSE;
+
+    g_assert (ds->mode & IO_MODE_WRITE);
+
+    /* Within a batch, this waits for the commit. */
+
+    g_rec_mutex_lock (&ds->lock);
+
+    if (ds->batch_depth == 0)
+	retval = (_ds_write_header (ds, err) || _ds_sync_dir (ds, err));
+
+    g_rec_mutex_unlock (&ds->lock);
+    return retval;
+}
+
+
+void
+ds_set_durability (Dataset *ds, DSDurability durability)
+{
+    g_atomic_int_set (&ds->durability, durability);
+}
+
+
+void
+ds_begin_batch (Dataset *ds)
+{
+    g_assert (ds->mode & IO_MODE_WRITE);
+
+    g_rec_mutex_lock (&ds->lock);
+    ds->batch_depth++;
+    g_rec_mutex_unlock (&ds->lock);
+}
+
+
+gboolean
+ds_commit_batch (Dataset *ds, GError **err)
+{
+    gboolean retval = FALSE;
+    GSList *replaced, *iter;
+
+    g_rec_mutex_lock (&ds->lock);
+    g_assert (ds->batch_depth > 0);
+
+    if (--ds->batch_depth > 0)
+	goto done;
+
+    replaced = g_slist_reverse (ds->batch_replaced);
+    ds->batch_replaced = NULL;
+
+    /* Get all of the new data onto the disk before making any of it
+     * visible, then write the header, then make it all durable at
+     * once. If something fails, the replacements that we haven't
+     * made yet are abandoned. */
+
+    for (iter = replaced; iter; iter = iter->next) {
+	gchar *repname = g_strconcat (iter->data, "+new", NULL);
+
+	retval = _ds_sync_item (ds, repname, err);
+	g_free (repname);
+
+	if (retval)
+	    goto free;
+    }
+
+    for (iter = replaced; iter; iter = iter->next) {
+	gchar *repname = g_strconcat (iter->data, "+new", NULL);
+
+	retval = _ds_rename_large_item_full (ds, repname, iter->data, TRUE, err);
+	g_free (repname);
+
+	if (retval)
+	    goto free;
+    }
+
+    if (ds->header_dirty && _ds_write_header (ds, err))
+	retval = TRUE;
+    else
+	retval = _ds_sync_dir (ds, err);
+
+free:
+    for (iter = replaced; iter; iter = iter->next)
+	g_free (iter->data);
+    g_slist_free (replaced);
+done:
+    g_rec_mutex_unlock (&ds->lock);
+    return retval;
+}
+
+
 gboolean
 ds_close (Dataset *ds, GError **err)
 {
@@ -443,20 +1316,43 @@ ds_close (Dataset *ds, GError **err)
     if (ds == NULL)
 	return FALSE;
 
-    if (ds->header_dirty)
+    if (ds->batch_depth > 0) {
+	/* Commit whatever's outstanding. */
+	ds->batch_depth = 1;
+	if (ds_commit_batch (ds, err))
+	    retval = TRUE;
+    } else if (ds->header_dirty)
 	if (ds_write_header (ds, err))
 	    retval = TRUE;
 
-    if (ds->namebuf != NULL) {
-	g_free (ds->namebuf);
-	ds->namebuf = NULL;
+    if (ds->cache_dirty && (ds->oflags & DS_OFLAGS_ITEM_CACHE))
+	_ds_cache_save (ds);
+
+    if (ds->item_cache) {
+	g_hash_table_destroy (ds->item_cache);
+	ds->item_cache = NULL;
+    }
+
+    if (ds->dirfd >= 0) {
+	close (ds->dirfd);
+	ds->dirfd = -1;
     }
 
-    if (ds->small_items) {
-	g_hash_table_destroy (ds->small_items);
-	ds->small_items = NULL;
+    g_free (ds->name);
+    ds->name = NULL;
+    g_rec_mutex_clear (&ds->lock);
+
+    _ds_small_clear (&ds->small_items);
+    g_clear_error (&ds->header_err);
+
+    if (ds->item_hints) {
+	g_hash_table_destroy (ds->item_hints);
+	ds->item_hints = NULL;
     }
 
+    g_slist_foreach (ds->batch_replaced, (GFunc) g_free, NULL);
+    g_slist_free (ds->batch_replaced);
+
     g_free (ds);
     return retval;
 }
@@ -465,64 +1361,209 @@ ds_close (Dataset *ds, GError **err)
 gboolean
 ds_has_item (Dataset *ds, const gchar *name)
 {
+    gboolean small;
+
     g_return_val_if_fail (name != NULL, FALSE);
     g_return_val_if_fail (strlen (name) <= DS_ITEMNAME_MAXLEN,
 			  FALSE);
 
-    if (g_hash_table_lookup (ds->small_items, name) != NULL)
+    g_rec_mutex_lock (&ds->lock);
+    small = (!_ds_load_header (ds, NULL) &&
+	     _ds_small_lookup (&ds->small_items, name) != NULL);
+    g_rec_mutex_unlock (&ds->lock);
+
+    if (small)
 	return TRUE;
 
-    _ds_set_name_item (ds, name);
-    return g_file_test (ds->namebuf, G_FILE_TEST_EXISTS);
+    return faccessat (ds->dirfd, name, F_OK, 0) == 0;
 }
 
-/* Caller's reponsibility to free the list as well as its
- * contents */
-gboolean
-ds_list_items (Dataset *ds, GSList **items, GError **err)
+static gboolean
+_ds_list_items (Dataset *ds, GSList **items, GError **err)
 {
     GSList *itemwork = NULL;
-    GDir *dir;
+    DIR *dir;
     const gchar *diritem;
     GHashTableIter hiter;
+    GHashTable *oldcache;
+    DSCachedItem *ci;
+    DSFileStamp dirstamp;
+    gboolean have_stamp;
+    struct stat statbuf;
+    guint i;
 
     *items = NULL;
-    _ds_set_name_dir (ds);
-    dir = g_dir_open (ds->namebuf, 0, err);
 
-    if (dir == NULL)
+    /* If the directory hasn't changed since we last read it, the
+     * cache already knows which large items there are. */
+
+    have_stamp = (fstat (ds->dirfd, &statbuf) == 0);
+
+    if (have_stamp) {
+	_ds_stamp (&statbuf, &dirstamp);
+
+	if (ds->list_cached && _ds_stamp_equal (&dirstamp, &ds->dir_stamp)) {
+	    if (ds->item_cache != NULL) {
+		g_hash_table_iter_init (&hiter, ds->item_cache);
+
+		while (g_hash_table_iter_next (&hiter, (gpointer *) &diritem, NULL)) {
+		    if (_ds_small_lookup (&ds->small_items, diritem) != NULL)
+			goto both;
+
+		    itemwork = g_slist_prepend (itemwork, g_strdup (diritem));
+		}
+	    }
+
+	    goto smalls;
+	}
+    }
+
+    if ((dir = _ds_open_dir (ds, err)) == NULL)
 	return TRUE;
 
-    while ((diritem = g_dir_read_name (dir)) != NULL) {
+    /* Rebuild the listing, keeping what we know about items that are
+     * still there. */
+
+    oldcache = ds->item_cache;
+    ds->item_cache = NULL;
+    ds->list_cached = FALSE;
+    ds->cache_dirty = TRUE;
+
+    while ((diritem = _ds_read_dir (dir)) != NULL) {
 	if (strlen (diritem) > DS_ITEMNAME_MAXLEN)
 	    continue;
 
 	if (strcmp (diritem, "header") == 0)
 	    continue;
 
-	if (g_hash_table_lookup (ds->small_items, diritem) != NULL) {
+	if (_ds_small_lookup (&ds->small_items, diritem) != NULL) {
 	    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
 			 "Invalid dataset: item %s has both file "
 			 "and header entry.", diritem);
-	    g_slist_foreach (itemwork, (GFunc) g_free, NULL);
-	    g_slist_free (itemwork);
-	    return TRUE;
+	    closedir (dir);
+	    if (oldcache != NULL)
+		g_hash_table_destroy (oldcache);
+	    goto fail;
 	}
 
 	itemwork = g_slist_prepend (itemwork, g_strdup (diritem));
+
+	ci = _ds_cache_get (ds, diritem, TRUE);
+
+	if (oldcache != NULL) {
+	    DSCachedItem *old = g_hash_table_lookup (oldcache, diritem);
+
+	    if (old != NULL)
+		*ci = *old;
+	}
     }
 
-    g_dir_close (dir);
-    g_hash_table_iter_init (&hiter, ds->small_items);
+    closedir (dir);
 
-    while (g_hash_table_iter_next (&hiter, (gpointer *) &diritem, 
-				   NULL))
-	itemwork = g_slist_prepend (itemwork, g_strdup (diritem));
+    if (oldcache != NULL)
+	g_hash_table_destroy (oldcache);
+
+    if (have_stamp && _ds_stamp_settled (&dirstamp)) {
+	ds->list_cached = TRUE;
+	ds->dir_stamp = dirstamp;
+    }
+
+smalls:
+    for (i = 0; i < ds->small_items.nitems; i++)
+	itemwork = g_slist_prepend (itemwork,
+				    g_strdup (ds->small_items.items[i].name));
 
     *items = itemwork;
     return FALSE;
+
+both:
+    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
+		 "Invalid dataset: item %s has both file "
+		 "and header entry.", diritem);
+fail:
+    g_slist_foreach (itemwork, (GFunc) g_free, NULL);
+    g_slist_free (itemwork);
+    return TRUE;
+}
+
+/* Caller's reponsibility to free the list as well as its
+ * contents */
+gboolean
+ds_list_items (Dataset *ds, GSList **items, GError **err)
+{
+    gboolean retval;
+
+    g_rec_mutex_lock (&ds->lock);
+    *items = NULL;
+    retval = _ds_load_header (ds, err) || _ds_list_items (ds, items, err);
+    g_rec_mutex_unlock (&ds->lock);
+    return retval;
+}
+
+gboolean
+ds_lookup_access_hint (Dataset *ds, const gchar *name, IOAccessHint *hint)
+{
+    gboolean found = TRUE;
+    gpointer value;
+
+    g_rec_mutex_lock (&ds->lock);
+
+    if (name != NULL && ds->item_hints != NULL &&
+	g_hash_table_lookup_extended (ds->item_hints, name, NULL, &value))
+	*hint = GPOINTER_TO_INT (value);
+    else if (ds->hint_set)
+	*hint = ds->hint;
+    else
+	found = FALSE;
+
+    g_rec_mutex_unlock (&ds->lock);
+    return found;
+}
+
+
+IOAccessHint
+ds_get_access_hint (Dataset *ds, const gchar *name)
+{
+    IOAccessHint hint = IO_HINT_NORMAL;
+
+    ds_lookup_access_hint (ds, name, &hint);
+    return hint;
+}
+
+
+void
+ds_set_access_hint (Dataset *ds, const gchar *name, IOAccessHint hint)
+{
+    g_return_if_fail (name == NULL || strlen (name) <= DS_ITEMNAME_MAXLEN);
+
+    g_rec_mutex_lock (&ds->lock);
+
+    if (name == NULL) {
+	ds->hint = hint;
+	ds->hint_set = TRUE;
+    } else {
+	if (ds->item_hints == NULL)
+	    ds->item_hints = g_hash_table_new_full (g_str_hash, g_str_equal,
+						    g_free, NULL);
+
+	g_hash_table_insert (ds->item_hints, g_strdup (name),
+			     GINT_TO_POINTER (hint));
+    }
+
+    g_rec_mutex_unlock (&ds->lock);
+}
+
+
+static void
+_ds_apply_access_hint (Dataset *ds, const gchar *name, IOStream *io)
+{
+    IOAccessHint hint = ds_get_access_hint (ds, name);
+
+    if (hint != IO_HINT_NORMAL)
+	io_set_access_hint (io, hint);
 }
 
+
 static IOStream *
 _ds_open_large_item_full (Dataset *ds, const gchar *name, IOMode mode,
 			  DSOpenFlags flags, gboolean trunc_ok,
@@ -532,6 +1573,8 @@ _ds_open_large_item_full (Dataset *ds, const gchar *name, IOMode mode,
      * keep in mind that ds may not be fully initialized. */
 
     int fd, oflags = 0;
+    goffset align_hint = 0;
+    IOStream *io;
 
     switch (mode) {
     case IO_MODE_READ:
@@ -557,31 +1600,111 @@ _ds_open_large_item_full (Dataset *ds, const gchar *name, IOMode mode,
 	    }
 	    oflags |= O_TRUNC;
 	} else if (flags & DS_OFLAGS_APPEND)
-	    oflags |= O_APPEND;
+	    /* Opened read-write so that the IOStream can pick up the
+	     * partial block at the end of the file and issue only whole-
+	     * block writes. We seek to the end ourselves. */
+	    oflags = (oflags & ~O_WRONLY) | O_RDWR;
 	else
 	    g_assert_not_reached ();
 	break;
+    case IO_MODE_READ_WRITE:
+	/* For modifying items in place. There's no appending as such,
+	 * but writes past the end of the item extend it. */
+	oflags = O_RDWR;
+
+	if (flags & DS_OFLAGS_CREATE_OK)
+	    oflags |= O_CREAT;
+
+	if (flags & DS_OFLAGS_EXIST_BAD)
+	    oflags |= O_CREAT | O_EXCL;
+
+	if ((oflags & O_CREAT) && check_name && !_ds_item_name_ok (name, err))
+	    return NULL;
+
+	if (flags & DS_OFLAGS_TRUNCATE) {
+	    if (ds->oflags & DS_OFLAGS_APPEND && !trunc_ok) {
+		g_set_error (err, DS_ERROR, DS_ERROR_INTERNAL_PERMS, "Cannot "
+			     "truncate item \"%s\" with dataset in append mode", name);
+		return NULL;
+	    }
+	    oflags |= O_TRUNC;
+	}
+	break;
     default:
-	/* Simultaneous read-write not allowed. */
 	g_assert_not_reached ();
     }
 
-    _ds_set_name_item (ds, name);
-    fd = open (ds->namebuf, oflags, 0644);
+    if (mode != IO_MODE_READ) {
+	g_rec_mutex_lock (&ds->lock);
+	_ds_cache_forget (ds, name);
+	g_rec_mutex_unlock (&ds->lock);
+    }
+
+    oflags |= O_CLOEXEC;
+    fd = openat (ds->dirfd, name, oflags, 0644);
+
+    if (fd < 0 && errno == EACCES && mode == IO_MODE_WRITE) {
+	/* Write-only file; fall back to a plain append. */
+	oflags = (oflags & ~O_RDWR) | O_WRONLY | O_APPEND;
+	fd = openat (ds->dirfd, name, oflags, 0644);
+    }
 
     if (fd < 0) {
-	IO_ERRNO_ERRV (err, errno, "Failed to open item file \"%s\"",
-		       ds->namebuf);
+	IO_ERRNO_ERRV (err, errno, "Failed to open item file \"%s/%s\"",
+		       ds->name, name);
 	if (errno_dest != NULL)
 	    *errno_dest = errno;
 	return NULL;
     }
 
-    /* FIXME: if opening for write and not truncating, we should
-     * figure out the alignment hint ... and prefill the write
-     * buffer :-( */
+    if (mode == IO_MODE_READ && (flags & DS_OFLAGS_MMAP)) {
+	/* If mapping fails, quietly fall back to the buffered stream. */
+	if ((io = io_new_mapped_from_fd (fd, NULL)) != NULL) {
+	    _ds_apply_access_hint (ds, name, io);
+	    return io;
+	}
+    }
+
+    if (mode == IO_MODE_WRITE && !(flags & DS_OFLAGS_TRUNCATE)) {
+	if ((align_hint = lseek (fd, 0, SEEK_END)) < 0) {
+	    IO_ERRNO_ERRV (err, errno, "Failed to seek item file \"%s/%s\"",
+			   ds->name, name);
+	    if (errno_dest != NULL)
+		*errno_dest = errno;
+	    close (fd);
+	    return NULL;
+	}
+    }
+
+    if ((flags & DS_OFLAGS_DIRECT) && mode != IO_MODE_READ_WRITE) {
+	io = io_new_from_fd (mode, fd, DS_DIRECT_BUFSZ, align_hint);
+
+	if (io_enable_direct (io, err)) {
+	    io_close_and_free (io, NULL);
+	    return NULL;
+	}
+    } else
+	io = io_new_from_fd (mode, fd, 0, align_hint);
+
+    if (mode == IO_MODE_READ && (flags & DS_OFLAGS_READAHEAD)) {
+	if (io_enable_readahead (io, DS_READAHEAD_NBLOCKS, 0, err)) {
+	    io_close_and_free (io, NULL);
+	    return NULL;
+	}
+    } else if ((flags & DS_OFLAGS_URING) && mode != IO_MODE_READ_WRITE) {
+	if (io_enable_uring (io, DS_URING_NBLOCKS, err)) {
+	    io_close_and_free (io, NULL);
+	    return NULL;
+	}
+    } else if (mode == IO_MODE_WRITE && (flags & DS_OFLAGS_WRITEBEHIND)) {
+	if (io_enable_writebehind (io, DS_WRITEBEHIND_NBLOCKS, err)) {
+	    io_close_and_free (io, NULL);
+	    return NULL;
+	}
+    }
 
-    return io_new_from_fd (mode, fd, 0, 0);
+    _ds_apply_access_hint (ds, name, io);
+    return io;
 }
 
 IOStream *
@@ -608,12 +1731,26 @@ ds_open_large_item_for_replace (Dataset *ds, const gchar *name, GError **err)
 gboolean
 ds_finish_large_item_replace (Dataset *ds, const gchar *name, GError **err)
 {
-    gchar *repname;
-    gboolean retval;
+    gboolean retval = FALSE;
 
-    repname = g_strconcat (name, "+new", NULL);
-    retval = _ds_rename_large_item_full (ds, repname, name, TRUE, err);
-    g_free (repname);
+    /* Within a batch, just remember the item for the commit. */
+
+    g_rec_mutex_lock (&ds->lock);
+
+    if (ds->batch_depth == 0) {
+	g_rec_mutex_unlock (&ds->lock);
+	return (_ds_replace_large_item (ds, name, err) ||
+		_ds_sync_dir (ds, err));
+    }
+
+    if (!_ds_item_name_ok (name, err))
+	retval = TRUE;
+    else if (g_slist_find_custom (ds->batch_replaced, name,
+				  (GCompareFunc) strcmp) == NULL)
+	ds->batch_replaced = g_slist_prepend (ds->batch_replaced,
+					      g_strdup (name));
+
+    g_rec_mutex_unlock (&ds->lock);
     return retval;
 }
 
@@ -622,31 +1759,63 @@ static gboolean
 _ds_probe_large_item (Dataset *ds, const gchar *name, DSType *type,
 		      gsize *nvals, int *openerr, GError **err)
 {
-    IOStream *io;
     gssize nread;
-    gchar *data;
+    gchar data[4];
     guint32 v;
     gboolean retval;
     struct stat statbuf;
-    int ofs;
+    DSCachedItem *ci, cached;
+    DSFileStamp stamp;
+    int fd, ofs;
 
     *type = DST_BIN;
     *nvals = 0;
+    *openerr = 0;
     retval = TRUE;
 
-    if ((io = _ds_open_large_item_full (ds, name, IO_MODE_READ, 0, FALSE,
-					TRUE, openerr, err)) == NULL)
+    /* If the cache knows the item and it hasn't changed, we're done.
+     * (If it's gone, we let the open below report that.) The I/O
+     * happens without the lock, so that probes can run in parallel. */
+
+    g_rec_mutex_lock (&ds->lock);
+    cached.probed = FALSE;
+    if ((ci = _ds_cache_get (ds, name, FALSE)) != NULL)
+	cached = *ci;
+    g_rec_mutex_unlock (&ds->lock);
+
+    if (cached.probed && fstatat (ds->dirfd, name, &statbuf, 0) == 0) {
+	_ds_stamp (&statbuf, &stamp);
+
+	if (_ds_stamp_equal (&stamp, &cached.stamp)) {
+	    *type = cached.type;
+	    *nvals = cached.nvals;
+	    return FALSE;
+	}
+    }
+
+    /* All we need is the first four bytes and the size, which we can
+     * get without the expense of setting up a stream. */
+
+    if ((fd = openat (ds->dirfd, name, O_RDONLY | O_CLOEXEC)) < 0) {
+	IO_ERRNO_ERRV (err, errno, "Failed to open item file \"%s/%s\"",
+		       ds->name, name);
+	*openerr = errno;
 	return TRUE;
+    }
 
-    if (fstat (io_get_fd (io), &statbuf)) {
+    if (fstat (fd, &statbuf)) {
 	IO_ERRNO_ERRV (err, errno, "Unable to stat dataset item \"%s\"", name);
 	goto done;
     }
 
-    nread = io_read_into_temp_buf (io, 4, (gpointer *) &data, err);
+    do
+	nread = pread (fd, data, sizeof (data), 0);
+    while (nread < 0 && errno == EINTR);
 
-    if (nread < 0)
+    if (nread < 0) {
+	IO_ERRNO_ERRV (err, errno, "Failed to read dataset item \"%s\"", name);
 	goto done;
+    }
 
     /* From here on out, we've done all of the IO that we need to,
      * so even if we can't identify the type we won't encounter
@@ -700,7 +1869,23 @@ _ds_probe_large_item (Dataset *ds, const gchar *name, DSType *type,
     }
 
 done:
-    io_close_and_free (io, NULL);
+    close (fd);
+
+    if (!retval) {
+	_ds_stamp (&statbuf, &stamp);
+
+	if (_ds_stamp_settled (&stamp)) {
+	    g_rec_mutex_lock (&ds->lock);
+	    ci = _ds_cache_get (ds, name, TRUE);
+	    ci->probed = TRUE;
+	    ci->type = *type;
+	    ci->nvals = *nvals;
+	    ci->stamp = stamp;
+	    ds->cache_dirty = TRUE;
+	    g_rec_mutex_unlock (&ds->lock);
+	}
+    }
+
     return retval;
 }
 
@@ -716,26 +1901,38 @@ ds_probe_item (Dataset *ds, const gchar *name, DSItemInfo **info, GError **err)
     int openerr;
 
     *info = NULL;
-    small = (DSSmallItem *) g_hash_table_lookup (ds->small_items, name);
+    dii = g_new0 (DSItemInfo, 1);
+
+    g_rec_mutex_lock (&ds->lock);
+
+    if (_ds_load_header (ds, err)) {
+	g_rec_mutex_unlock (&ds->lock);
+	g_free (dii);
+	return TRUE;
+    }
+
+    small = _ds_small_lookup (&ds->small_items, name);
     is_large = (small == NULL);
 
     if (!is_large) {
 	type = small->type;
 	nvals = small->nvals;
-    } else {
-	if (_ds_probe_large_item (ds, name, &type, &nvals, &openerr, err))
-	    return openerr != ENOENT;
+	memcpy (dii->small.i8, DSI_DATA (small), nvals * ds_type_sizes[type]);
+    }
+
+    g_rec_mutex_unlock (&ds->lock);
+
+    if (is_large &&
+	_ds_probe_large_item (ds, name, &type, &nvals, &openerr, err)) {
+	g_free (dii);
+	return openerr != ENOENT;
     }
 
-    *info = dii = g_new0 (DSItemInfo, 1);
+    *info = dii;
     dii->name = g_strdup (name);
     dii->is_large = is_large;
     dii->type = type;
     dii->nvals = nvals;
-
-    if (!is_large)
-	memcpy (dii->small.i8, DSI_DATA (small), nvals * ds_type_sizes[type]);
-
     return FALSE;
 }
 
@@ -750,55 +1947,61 @@ gboolean
 ds_get_item_i64 (Dataset *ds, const gchar *name, gint64 *val)
 {
     DSSmallItem *small;
+    gboolean retval = TRUE;
 
-    small = (DSSmallItem *) g_hash_table_lookup (ds->small_items, name);
-
-    if (small == NULL)
-	return TRUE;
+    g_rec_mutex_lock (&ds->lock);
+    small = NULL;
+    if (!_ds_load_header (ds, NULL))
+	small = _ds_small_lookup (&ds->small_items, name);
 
-    if (small->nvals != 1)
-	return TRUE;
+    if (small != NULL && small->nvals == 1)
+	retval = ds_type_upconvert (small->type, DSI_DATA(small), DST_I64,
+				    (gpointer) val, 1);
 
-    return ds_type_upconvert (small->type, DSI_DATA(small), DST_I64,
-			      (gpointer) val, 1);
+    g_rec_mutex_unlock (&ds->lock);
+    return retval;
 }
 
 gboolean
 ds_get_item_f64 (Dataset *ds, const gchar *name, gdouble *val)
 {
     DSSmallItem *small;
+    gboolean retval = TRUE;
 
-    small = (DSSmallItem *) g_hash_table_lookup (ds->small_items, name);
-
-    if (small == NULL)
-	return TRUE;
+    g_rec_mutex_lock (&ds->lock);
+    small = NULL;
+    if (!_ds_load_header (ds, NULL))
+	small = _ds_small_lookup (&ds->small_items, name);
 
-    if (small->nvals != 1)
-	return TRUE;
+    if (small != NULL && small->nvals == 1)
+	retval = ds_type_upconvert (small->type, DSI_DATA (small), DST_F64,
+				    (gpointer) val, 1);
 
-    return ds_type_upconvert (small->type, DSI_DATA (small), DST_F64,
-			      (gpointer) val, 1);
+    g_rec_mutex_unlock (&ds->lock);
+    return retval;
 }
 
 gchar *
 ds_get_item_small_string (Dataset *ds, const gchar *name)
 {
     DSSmallItem *small;
+    gchar *retval = NULL;
 
-    small = (DSSmallItem *) g_hash_table_lookup (ds->small_items, name);
+    g_rec_mutex_lock (&ds->lock);
+    small = NULL;
+    if (!_ds_load_header (ds, NULL))
+	small = _ds_small_lookup (&ds->small_items, name);
 
-    if (small == NULL)
-	return NULL;
+    /* Note: textual small items are stored with a type indicator of
+     * i8, not text. Unsure if there is a way to distinguish between
+     * the two -- probably nothing creates a small item with an actual
+     * type of i8 unless it's trying to break things intentionally. */
 
-    if (small->type != DST_I8)
-	/* Note: textual small items are stored with a type
-	 * indicator of i8, not text. Unsure if there is a way to
-	 * distinguish between the two -- probably nothing creates
-	 * a small item with an actual type of i8 unless it's
-	 * trying to break things intentionally. */
-	return NULL;
+    if (small != NULL && small->type == DST_I8)
+	retval = g_strndup (small->vals.text, small->nvals);
 
-    return g_strndup (small->vals.text, small->nvals);
+    g_rec_mutex_unlock (&ds->lock);
+    return retval;
 }
 
 static gboolean
@@ -840,6 +2043,7 @@ ds_set_small_item (Dataset *ds, const gchar *name, DSType type, gsize nvals,
 		   gpointer data, gboolean create_ok)
 {
     DSSmallItem *small;
+    DSError retval = DS_ERROR_NO_ERROR;
 
     if (!(ds->mode & IO_MODE_WRITE))
 	return DS_ERROR_INTERNAL_PERMS;
@@ -847,27 +2051,55 @@ ds_set_small_item (Dataset *ds, const gchar *name, DSType type, gsize nvals,
     if (nvals * ds_type_sizes[type] > 64)
 	return DS_ERROR_FORMAT;
 
-    small = (DSSmallItem *) g_hash_table_lookup (ds->small_items, name);
+    g_rec_mutex_lock (&ds->lock);
+
+    if (_ds_load_header (ds, NULL)) {
+	if (ds->header_err->domain == DS_ERROR)
+	    retval = ds->header_err->code;
+	else
+	    retval = DS_ERROR_IO;
+	goto done;
+    }
+
+    small = _ds_small_lookup (&ds->small_items, name);
 
     if (small != NULL) {
 	/* Can't modify existing items in append mode. */
-	if (ds->oflags & DS_OFLAGS_APPEND)
-	    return DS_ERROR_INTERNAL_PERMS;
+	if (ds->oflags & DS_OFLAGS_APPEND) {
+	    retval = DS_ERROR_INTERNAL_PERMS;
+	    goto done;
+	}
     } else {
-	if (!create_ok)
-	    return DS_ERROR_NONEXISTANT;
+	if (!create_ok) {
+	    retval = DS_ERROR_NONEXISTANT;
+	    goto done;
+	}
 
-	if (!_ds_item_name_ok (name, NULL))
-	    return DS_ERROR_ITEM_NAME;
+	if (!_ds_item_name_ok (name, NULL)) {
+	    retval = DS_ERROR_ITEM_NAME;
+	    goto done;
+	}
+
+	small = _ds_small_insert (&ds->small_items, name);
+    }
+
+    /* If the item keeps its place in the header, the header can be
+     * patched rather than rewritten. */
 
-	small = g_new0 (DSSmallItem, 1);
-	strcpy (small->name, name);
-	g_hash_table_insert (ds->small_items, small->name, small);
+    if (small->hofs >= 0 && small->type == type && small->nvals == nvals) {
+	if (memcmp (DSI_DATA (small), data, nvals * ds_type_sizes[type]))
+	    small->stale = TRUE;
+    } else {
+	small->hofs = -1;
+	ds->header_relayout = TRUE;
     }
 
     small->type = type;
     small->nvals = nvals;
     memcpy (DSI_DATA (small), data, nvals * ds_type_sizes[type]);
     ds->header_dirty = TRUE;
-    return DS_ERROR_NO_ERROR;
+
+done:
+    g_rec_mutex_unlock (&ds->lock);
+    return retval;
 }
@@ -8,7 +8,8 @@
 typedef struct _Dataset Dataset;
 
 typedef enum _DSOpenFlags {
-    /* For whole datasets, if opening for read only, flags are ignored.
+    /* For whole datasets, if opening for read only, flags other than
+     * ITEM_CACHE and EAGER_HEADER are ignored.
      * Opening for write only is disallowed.
      * Otherwise,
      * - CREATE_OK indicates that if the named dataset doesn't exist,
@@ -25,9 +26,32 @@ typedef enum _DSOpenFlags {
      * - If no such dataset exists, fail.
      * - Existing items may be modified in any way.
      * - The dataset will not be modified upon open.
+     * In any mode, ITEM_CACHE keeps the types and sizes of the large
+     * items in a sidecar file in the dataset, so that listing and
+     * probing them needn't open every item each time. Entries are
+     * checked against each item's size, mtime and inode before use.
+     * The sidecar is written on close, if possible; failure to write
+     * it isn't an error. The header, which holds the small items, is
+     * read the first time a small item is needed, so problems with it
+     * are reported then; EAGER_HEADER reads it on open instead.
      *
-     * For dataset items, if opening readonly, flags are ignored.
-     * Otherwise,
+     * For dataset items, if opening readonly, flags other than MMAP
+     * are ignored. MMAP requests that the item be memory-mapped so
+     * that reads return pointers directly into the file contents; if
+     * the item can't be mapped, it is read through a regular buffered
+     * stream. READAHEAD requests that a helper thread read the item
+     * ahead of the caller with the default depth and block size (see
+     * io_enable_readahead() for finer control); MMAP takes priority
+     * over it. URING requests that the item be read or written with
+     * several asynchronous requests in flight through io_uring, where
+     * available (see io_enable_uring()). DIRECT requests that the
+     * item be transferred in large blocks with O_DIRECT, bypassing
+     * the page cache, for streaming through items too big to be worth
+     * caching (see io_enable_direct()); it can be combined with
+     * READAHEAD or URING but not MMAP. WRITEBEHIND requests that a
+     * helper thread do the writing, so that writes return without
+     * waiting for the disk (see io_enable_writebehind()); URING takes
+     * priority over it. Otherwise,
      * - CREATE_OK indicates that if the named item doesn't exist,
      *   it should be created as an empty file.
      * - EXIST_BAD indicates that if the named item does exist,
@@ -43,6 +67,13 @@ typedef enum _DSOpenFlags {
     DS_OFLAGS_EXIST_BAD = 1 << 1,
     DS_OFLAGS_TRUNCATE  = 1 << 2,
     DS_OFLAGS_APPEND    = 1 << 3,
+    DS_OFLAGS_MMAP      = 1 << 4,
+    DS_OFLAGS_READAHEAD = 1 << 5,
+    DS_OFLAGS_URING     = 1 << 6,
+    DS_OFLAGS_DIRECT    = 1 << 7,
+    DS_OFLAGS_WRITEBEHIND = 1 << 8,
+    DS_OFLAGS_ITEM_CACHE = 1 << 9,
+    DS_OFLAGS_EAGER_HEADER = 1 << 10,
 } DSOpenFlags;
 
 /* Custom errors */
@@ -57,12 +88,20 @@ typedef enum _DSError {
     DS_ERROR_INTERNAL_PERMS = 2,
     DS_ERROR_ITEM_NAME = 3,
     DS_ERROR_NONEXISTANT = 4,
+    DS_ERROR_IO = 5,
 } DSError;
 
 extern const gchar *ds_error_describe (DSError error);
 
 
-/* Dataset access */
+/* Dataset access
+ *
+ * A Dataset may be shared between threads. Small items, hints and the
+ * item cache are guarded by a lock in the dataset, but large items are
+ * opened, probed and read without holding it, so threads can work on
+ * different large items in parallel. Each IOStream returned belongs to
+ * one thread at a time, and ds_close() must not run concurrently with
+ * anything else on the dataset. */
 
 typedef struct _DSItemInfo {
     gchar *name;
@@ -91,6 +130,20 @@ extern IOStream *ds_open_large_item (Dataset *ds, const gchar *name, IOMode mode
 				     DSOpenFlags flags, GError **err);
 extern gboolean ds_probe_item (Dataset *ds, const gchar *name, DSItemInfo **info,
 			       GError **err);
+
+/* Access hints (see io_set_access_hint()) applied to large items as
+ * they're opened: to the item @name, or if @name is NULL, to every
+ * item without a hint of its own. */
+
+extern void ds_set_access_hint (Dataset *ds, const gchar *name, IOAccessHint hint);
+extern IOAccessHint ds_get_access_hint (Dataset *ds, const gchar *name);
+
+/* Like ds_get_access_hint(), but returns FALSE, leaving *@hint alone,
+ * if no hint has been set that applies to @name. This distinguishes
+ * an explicit IO_HINT_NORMAL from no hint at all. */
+
+extern gboolean ds_lookup_access_hint (Dataset *ds, const gchar *name,
+				       IOAccessHint *hint);
 extern void ds_item_info_free (DSItemInfo *dii);
 
 extern IOStream *ds_open_large_item_for_replace (Dataset *ds, const gchar *name,
@@ -98,9 +151,15 @@ extern IOStream *ds_open_large_item_for_replace (Dataset *ds, const gchar *name,
 extern gboolean ds_finish_large_item_replace (Dataset *ds, const gchar *name,
 					      GError **err);
 
+/* The small-item getters, and ds_has_item(), can't say why they
+ * failed. If the header couldn't be read, they act as if the item
+ * didn't exist; ds_get_header_error() then returns TRUE and sets @err
+ * to the reason. */
+
 extern gboolean ds_get_item_i64 (Dataset *ds, const gchar *name, gint64 *val);
 extern gboolean ds_get_item_f64 (Dataset *ds, const gchar *name, gdouble *val);
 extern gchar *ds_get_item_small_string (Dataset *ds, const gchar *name);
+extern gboolean ds_get_header_error (Dataset *ds, GError **err);
 
 extern DSError ds_set_small_item (Dataset *ds, const gchar *name, DSType type,
 				  gsize nvals, gpointer data, gboolean create_ok);
@@ -123,4 +182,62 @@ extern gboolean ds_rename_large_item (Dataset *ds, const gchar *oldname,
 
 extern gboolean ds_write_header (Dataset *ds, GError **err);
 
+/* How hard header writes and large item replacements try to survive a
+ * crash. NONE leaves writeback to the kernel; DATA fdatasync()s each
+ * file before renaming it into place; DIR also fsync()s the dataset
+ * directory afterwards, so that the renames themselves are durable.
+ * The default is NONE. */
+
+typedef enum _DSDurability {
+    DS_DURABILITY_NONE = 0,
+    DS_DURABILITY_DATA,
+    DS_DURABILITY_DIR,
+} DSDurability;
+
+extern void ds_set_durability (Dataset *ds, DSDurability durability);
+
+/* Flush large item @name's data to disk, if the durability setting
+ * is DATA or higher, for items written in place rather than replaced,
+ * which nothing else syncs. */
+
+extern gboolean ds_sync_large_item (Dataset *ds, const gchar *name,
+				    GError **err);
+
+/* Between ds_begin_batch() and ds_commit_batch(), ds_write_header()
+ * does nothing and ds_finish_large_item_replace() only notes the item,
+ * so that the commit can write the header once and make everything
+ * durable together: the replaced items are synced, then renamed into
+ * place, then the header is written, then the directory synced, as
+ * the durability setting asks. Batches nest; only the outermost
+ * commit does anything. ds_close() commits an unfinished batch. */
+
+extern void ds_begin_batch (Dataset *ds);
+extern gboolean ds_commit_batch (Dataset *ds, GError **err);
+
+/* Copying datasets (dscopy.c). ds_append() adds the items of @src to
+ * @dest, which must be open for writing: small items missing from
+ * @dest are added, ones already there must have the same values, and
+ * large items are appended to, @nthreads at a time (0 for a default).
+ * ds_copy() does the same into a newly created dataset. @progress, if
+ * not NULL, is called from the calling thread as large items finish.
+ * On failure, @dest may have been partially updated. */
+
+typedef struct _DSCopyProgress {
+    guint items_done; /* large items */
+    guint items_total;
+    guint64 bytes_done;
+    gdouble elapsed; /* seconds */
+    gdouble bytes_per_sec;
+} DSCopyProgress;
+
+typedef void (*DSCopyProgressFunc) (const DSCopyProgress *progress,
+				    gpointer data);
+
+extern gboolean ds_append (Dataset *src, Dataset *dest, guint nthreads,
+			   DSCopyProgressFunc progress, gpointer progress_data,
+			   GError **err);
+extern gboolean ds_copy (Dataset *src, const gchar *destname, guint nthreads,
+			 DSCopyProgressFunc progress, gpointer progress_data,
+			 GError **err);
+
 #endif
@@ -0,0 +1,382 @@
+#include <dataset.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+/* Copying the contents of one dataset into another. Everything is
+ * checked against the destination before anything is written. The
+ * large items are then copied by a handful of worker threads, each
+ * piping whole items through io_pipe(), which has the kernel do the
+ * copying (sharing extents, on filesystems that can) wherever
+ * possible. Progress is reported from the calling thread as each large
+ * item finishes. The small items go into the destination's header
+ * last, in the same batch, so that they only show up if the large
+ * items made it. */
+
+#define DS_COPY_DEFAULT_NTHREADS 4
+
+typedef struct _DSCopyJob {
+    Dataset *src;
+    Dataset *dest;
+    GSList *large; /* DSItemInfo of the large items to copy */
+
+    GMutex lock;
+    GCond cond;
+    GSList *next; /* the next item to be claimed */
+    guint nrunning;
+    DSCopyProgress progress;
+    GError *err; /* the first failure; the others are dropped */
+} DSCopyJob;
+
+
+static gboolean
+_ds_copy_large_item (DSCopyJob *job, const gchar *name, guint64 *nbytes,
+		     GError **err)
+{
+    IOStream *ioin, *ioout;
+    goffset start;
+
+    if ((ioin = ds_open_large_item (job->src, name, IO_MODE_READ,
+				    DS_OFLAGS_URING, err)) == NULL)
+	return TRUE;
+
+    if ((ioout = ds_open_large_item (job->dest, name, IO_MODE_WRITE,
+				     DS_OFLAGS_CREATE_OK | DS_OFLAGS_APPEND |
+				     DS_OFLAGS_URING, err)) == NULL) {
+	io_close_and_free (ioin, NULL);
+	return TRUE;
+    }
+
+    start = io_tell (ioout);
+
+    if (io_pipe (ioin, ioout, err)) {
+	io_close_and_free (ioin, NULL);
+	io_close_and_free (ioout, NULL);
+	return TRUE;
+    }
+
+    *nbytes = io_tell (ioout) - start;
+
+    if (io_close_and_free (ioin, err)) {
+	io_close_and_free (ioout, NULL);
+	return TRUE;
+    }
+
+    /* The header is only committed once every item is copied, so the
+     * data had better be on the disk by then, if it's meant to be. */
+
+    if (io_close_and_free (ioout, err))
+	return TRUE;
+
+    return ds_sync_large_item (job->dest, name, err);
+}
+
+
+static gpointer
+_ds_copy_worker (gpointer data)
+{
+    DSCopyJob *job = data;
+    DSItemInfo *dii;
+    GError *suberr = NULL;
+    guint64 nbytes;
+    gboolean failed;
+
+    g_mutex_lock (&job->lock);
+
+    while (job->next != NULL && job->err == NULL) {
+	dii = job->next->data;
+	job->next = job->next->next;
+	g_mutex_unlock (&job->lock);
+
+	nbytes = 0;
+	failed = _ds_copy_large_item (job, dii->name, &nbytes, &suberr);
+
+	g_mutex_lock (&job->lock);
+
+	if (failed) {
+	    if (job->err == NULL)
+		g_propagate_prefixed_error (&job->err, suberr,
+					    "Error copying large item \"%s\": ",
+					    dii->name);
+	    else
+		g_error_free (suberr);
+	    suberr = NULL;
+	} else {
+	    job->progress.items_done++;
+	    job->progress.bytes_done += nbytes;
+	}
+
+	g_cond_broadcast (&job->cond);
+    }
+
+    job->nrunning--;
+    g_cond_broadcast (&job->cond);
+    g_mutex_unlock (&job->lock);
+    return NULL;
+}
+
+
+/* Call with the job locked; the callback runs without the lock, so
+ * that it can't hold up the workers. */
+
+static void
+_ds_copy_report (DSCopyJob *job, gint64 start, DSCopyProgressFunc func,
+		 gpointer data)
+{
+    DSCopyProgress progress;
+
+    if (func == NULL)
+	return;
+
+    progress = job->progress;
+    g_mutex_unlock (&job->lock);
+
+    progress.elapsed = (g_get_monotonic_time () - start) * 1e-6;
+    progress.bytes_per_sec = 0;
+    if (progress.elapsed > 0)
+	progress.bytes_per_sec = progress.bytes_done / progress.elapsed;
+
+    func (&progress, data);
+    g_mutex_lock (&job->lock);
+}
+
+
+/* Check a small item against the destination, and queue it to be set
+ * there if it's new. */
+
+static gboolean
+_ds_copy_check_small (Dataset *dest, DSItemInfo *dii, GSList **toset,
+		      GError **err)
+{
+    DSItemInfo *outii;
+    gboolean retval = TRUE;
+
+    if (!ds_has_item (dest, dii->name)) {
+	*toset = g_slist_prepend (*toset, dii);
+	return FALSE;
+    }
+
+    if (ds_probe_item (dest, dii->name, &outii, err))
+	return TRUE;
+
+    if (outii == NULL) {
+	/* Gone since we looked. */
+	*toset = g_slist_prepend (*toset, dii);
+	return FALSE;
+    }
+
+    if (outii->is_large)
+	g_set_error (err, DS_ERROR, DS_ERROR_FORMAT, "Existing item \"%s\" in "
+		     "the destination is a large item but is a small one in the "
+		     "source", dii->name);
+    else if (outii->type != dii->type || outii->nvals != dii->nvals)
+	g_set_error (err, DS_ERROR, DS_ERROR_FORMAT, "Existing small item \"%s\" "
+		     "in the destination is of different type and/or size than "
+		     "in the source", dii->name);
+    else if (memcmp (dii->small.i8, outii->small.i8,
+		     ds_type_sizes[dii->type] * dii->nvals))
+	g_set_error (err, DS_ERROR, DS_ERROR_FORMAT, "Existing small item \"%s\" "
+		     "in the destination does not have the same value as the "
+		     "one in the source", dii->name);
+    else
+	retval = FALSE;
+
+    ds_item_info_free (outii);
+    return retval;
+}
+
+
+static gboolean
+_ds_copy_check_large (Dataset *dest, DSItemInfo *dii, GError **err)
+{
+    DSItemInfo *outii;
+    gboolean retval = FALSE;
+
+    if (!ds_has_item (dest, dii->name))
+	return FALSE;
+
+    if (ds_probe_item (dest, dii->name, &outii, err))
+	return TRUE;
+
+    if (outii == NULL)
+	return FALSE;
+
+    if (!outii->is_large) {
+	g_set_error (err, DS_ERROR, DS_ERROR_FORMAT, "Existing item \"%s\" in "
+		     "the destination is a small item but is a large one in the "
+		     "source", dii->name);
+	retval = TRUE;
+    }
+
+    ds_item_info_free (outii);
+    return retval;
+}
+
+
+gboolean
+ds_append (Dataset *src, Dataset *dest, guint nthreads,
+	   DSCopyProgressFunc progress, gpointer progress_data, GError **err)
+{
+    DSCopyJob job;
+    GSList *names, *infos = NULL, *toset = NULL, *iter;
+    GThread **threads;
+    gboolean retval = TRUE;
+    gint64 start;
+    guint i, nstarted, reported;
+
+    memset (&job, 0, sizeof (job));
+    job.src = src;
+    job.dest = dest;
+    start = g_get_monotonic_time ();
+
+    if (ds_list_items (src, &names, err))
+	return TRUE;
+
+    /* Look everything over before changing anything. */
+
+    for (iter = names; iter; iter = iter->next) {
+	DSItemInfo *dii;
+
+	if (ds_probe_item (src, iter->data, &dii, err))
+	    goto bail;
+
+	if (dii == NULL)
+	    /* Removed from the source since we listed it. */
+	    continue;
+
+	infos = g_slist_prepend (infos, dii);
+
+	if (dii->is_large) {
+	    if (_ds_copy_check_large (dest, dii, err))
+		goto bail;
+
+	    job.large = g_slist_prepend (job.large, dii);
+	} else if (_ds_copy_check_small (dest, dii, &toset, err))
+	    goto bail;
+    }
+
+    /* ds_has_item() takes an unreadable header to mean that the items
+     * aren't there, so make sure that's not what happened. */
+
+    if (ds_get_header_error (dest, err))
+	goto bail;
+
+    /* One batch for the whole copy, committed once the small items
+     * are in. */
+
+    ds_begin_batch (dest);
+
+    job.large = g_slist_reverse (job.large);
+
+    /* The large items, in parallel. If we can't start a thread, we do
+     * the work in this one. */
+
+    if (nthreads == 0)
+	nthreads = DS_COPY_DEFAULT_NTHREADS;
+    nthreads = MIN (nthreads, g_slist_length (job.large));
+
+    g_mutex_init (&job.lock);
+    g_cond_init (&job.cond);
+    job.next = job.large;
+    job.progress.items_total = g_slist_length (job.large);
+    threads = g_new0 (GThread *, nthreads);
+    nstarted = 0;
+
+    g_mutex_lock (&job.lock);
+
+    for (i = 0; i < nthreads; i++) {
+	threads[i] = g_thread_try_new ("viskit-copy", _ds_copy_worker,
+				       &job, NULL);
+	if (threads[i] != NULL) {
+	    job.nrunning++;
+	    nstarted++;
+	}
+    }
+
+    if (nstarted == 0 && job.next != NULL) {
+	job.nrunning++;
+	g_mutex_unlock (&job.lock);
+	_ds_copy_worker (&job);
+	g_mutex_lock (&job.lock);
+    }
+
+    reported = G_MAXUINT;
+
+    while (job.nrunning > 0) {
+	if (job.progress.items_done != reported) {
+	    reported = job.progress.items_done;
+	    _ds_copy_report (&job, start, progress, progress_data);
+	} else
+	    g_cond_wait (&job.cond, &job.lock);
+    }
+
+    _ds_copy_report (&job, start, progress, progress_data);
+    g_mutex_unlock (&job.lock);
+
+    for (i = 0; i < nthreads; i++)
+	if (threads[i] != NULL)
+	    g_thread_join (threads[i]);
+
+    g_free (threads);
+    g_cond_clear (&job.cond);
+    g_mutex_clear (&job.lock);
+
+    if (job.err != NULL) {
+	g_propagate_error (err, job.err);
+	ds_commit_batch (dest, NULL);
+	goto bail;
+    }
+
+    /* Now the small items, as one header update. */
+
+    for (iter = toset; iter; iter = iter->next) {
+	DSItemInfo *dii = iter->data;
+	DSError dserr;
+
+	dserr = ds_set_small_item (dest, dii->name, dii->type, dii->nvals,
+				   dii->small.i8, TRUE);
+
+	if (dserr) {
+	    g_set_error (err, DS_ERROR, dserr, "Error copying small item "
+			 "\"%s\": %s", dii->name, ds_error_describe (dserr));
+	    ds_commit_batch (dest, NULL);
+	    goto bail;
+	}
+    }
+
+    if (ds_commit_batch (dest, err))
+	goto bail;
+
+    retval = FALSE;
+
+bail:
+    g_slist_free (toset);
+    g_slist_free (job.large);
+    g_slist_foreach (infos, (GFunc) ds_item_info_free, NULL);
+    g_slist_free (infos);
+    g_slist_foreach (names, (GFunc) g_free, NULL);
+    g_slist_free (names);
+    return retval;
+}
+
+
+gboolean
+ds_copy (Dataset *src, const gchar *destname, guint nthreads,
+	 DSCopyProgressFunc progress, gpointer progress_data, GError **err)
+{
+    Dataset *dest;
+
+    if ((dest = ds_open (destname, IO_MODE_WRITE, DS_OFLAGS_EXIST_BAD,
+			 err)) == NULL)
+	return TRUE;
+
+    if (ds_append (src, dest, nthreads, progress, progress_data, err)) {
+	ds_close (dest, NULL);
+	return TRUE;
+    }
+
+    return ds_close (dest, err);
+}
@@ -0,0 +1,697 @@
+#include <types.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <math.h> /*isfinite, signbit*/
+#include <string.h> /*memcpy*/
+
+/* Fast formatting of typed values as text, without going through
+ * printf. Floats are written with Florian Loitsch's Grisu2
+ * algorithm, which always produces digits that read back to exactly
+ * the same value, and the shortest such digits in all but a tiny
+ * fraction of cases. Integers are written two digits at a time.
+ * Output goes through a fixed-size chunk, which is flushed to a
+ * GString or a FILE when it fills. */
+
+/* Grisu2. A DiyFp is an unnormalized floating-point number with a
+ * 64-bit significand: f * 2^e. */
+
+typedef struct _DiyFp {
+    guint64 f;
+    gint e;
+} DiyFp;
+
+static const DiyFp cached_powers[] = {
+    { G_GUINT64_CONSTANT (0xfa8fd5a0081c0288), -1220 }, { G_GUINT64_CONSTANT (0xbaaee17fa23ebf76), -1193 },
+    { G_GUINT64_CONSTANT (0x8b16fb203055ac76), -1166 }, { G_GUINT64_CONSTANT (0xcf42894a5dce35ea), -1140 },
+    { G_GUINT64_CONSTANT (0x9a6bb0aa55653b2d), -1113 }, { G_GUINT64_CONSTANT (0xe61acf033d1a45df), -1087 },
+    { G_GUINT64_CONSTANT (0xab70fe17c79ac6ca), -1060 }, { G_GUINT64_CONSTANT (0xff77b1fcbebcdc4f), -1034 },
+    { G_GUINT64_CONSTANT (0xbe5691ef416bd60c), -1007 }, { G_GUINT64_CONSTANT (0x8dd01fad907ffc3c), -980 },
+    { G_GUINT64_CONSTANT (0xd3515c2831559a83), -954 }, { G_GUINT64_CONSTANT (0x9d71ac8fada6c9b5), -927 },
+    { G_GUINT64_CONSTANT (0xea9c227723ee8bcb), -901 }, { G_GUINT64_CONSTANT (0xaecc49914078536d), -874 },
+    { G_GUINT64_CONSTANT (0x823c12795db6ce57), -847 }, { G_GUINT64_CONSTANT (0xc21094364dfb5637), -821 },
+    { G_GUINT64_CONSTANT (0x9096ea6f3848984f), -794 }, { G_GUINT64_CONSTANT (0xd77485cb25823ac7), -768 },
+    { G_GUINT64_CONSTANT (0xa086cfcd97bf97f4), -741 }, { G_GUINT64_CONSTANT (0xef340a98172aace5), -715 },
+    { G_GUINT64_CONSTANT (0xb23867fb2a35b28e), -688 }, { G_GUINT64_CONSTANT (0x84c8d4dfd2c63f3b), -661 },
+    { G_GUINT64_CONSTANT (0xc5dd44271ad3cdba), -635 }, { G_GUINT64_CONSTANT (0x936b9fcebb25c996), -608 },
+    { G_GUINT64_CONSTANT (0xdbac6c247d62a584), -582 }, { G_GUINT64_CONSTANT (0xa3ab66580d5fdaf6), -555 },
+    { G_GUINT64_CONSTANT (0xf3e2f893dec3f126), -529 }, { G_GUINT64_CONSTANT (0xb5b5ada8aaff80b8), -502 },
+    { G_GUINT64_CONSTANT (0x87625f056c7c4a8b), -475 }, { G_GUINT64_CONSTANT (0xc9bcff6034c13053), -449 },
+    { G_GUINT64_CONSTANT (0x964e858c91ba2655), -422 }, { G_GUINT64_CONSTANT (0xdff9772470297ebd), -396 },
+    { G_GUINT64_CONSTANT (0xa6dfbd9fb8e5b88f), -369 }, { G_GUINT64_CONSTANT (0xf8a95fcf88747d94), -343 },
+    { G_GUINT64_CONSTANT (0xb94470938fa89bcf), -316 }, { G_GUINT64_CONSTANT (0x8a08f0f8bf0f156b), -289 },
+    { G_GUINT64_CONSTANT (0xcdb02555653131b6), -263 }, { G_GUINT64_CONSTANT (0x993fe2c6d07b7fac), -236 },
+    { G_GUINT64_CONSTANT (0xe45c10c42a2b3b06), -210 }, { G_GUINT64_CONSTANT (0xaa242499697392d3), -183 },
+    { G_GUINT64_CONSTANT (0xfd87b5f28300ca0e), -157 }, { G_GUINT64_CONSTANT (0xbce5086492111aeb), -130 },
+    { G_GUINT64_CONSTANT (0x8cbccc096f5088cc), -103 }, { G_GUINT64_CONSTANT (0xd1b71758e219652c), -77 },
+    { G_GUINT64_CONSTANT (0x9c40000000000000), -50 }, { G_GUINT64_CONSTANT (0xe8d4a51000000000), -24 },
+    { G_GUINT64_CONSTANT (0xad78ebc5ac620000), 3 }, { G_GUINT64_CONSTANT (0x813f3978f8940984), 30 },
+    { G_GUINT64_CONSTANT (0xc097ce7bc90715b3), 56 }, { G_GUINT64_CONSTANT (0x8f7e32ce7bea5c70), 83 },
+    { G_GUINT64_CONSTANT (0xd5d238a4abe98068), 109 }, { G_GUINT64_CONSTANT (0x9f4f2726179a2245), 136 },
+    { G_GUINT64_CONSTANT (0xed63a231d4c4fb27), 162 }, { G_GUINT64_CONSTANT (0xb0de65388cc8ada8), 189 },
+    { G_GUINT64_CONSTANT (0x83c7088e1aab65db), 216 }, { G_GUINT64_CONSTANT (0xc45d1df942711d9a), 242 },
+    { G_GUINT64_CONSTANT (0x924d692ca61be758), 269 }, { G_GUINT64_CONSTANT (0xda01ee641a708dea), 295 },
+    { G_GUINT64_CONSTANT (0xa26da3999aef774a), 322 }, { G_GUINT64_CONSTANT (0xf209787bb47d6b85), 348 },
+    { G_GUINT64_CONSTANT (0xb454e4a179dd1877), 375 }, { G_GUINT64_CONSTANT (0x865b86925b9bc5c2), 402 },
+    { G_GUINT64_CONSTANT (0xc83553c5c8965d3d), 428 }, { G_GUINT64_CONSTANT (0x952ab45cfa97a0b3), 455 },
+    { G_GUINT64_CONSTANT (0xde469fbd99a05fe3), 481 }, { G_GUINT64_CONSTANT (0xa59bc234db398c25), 508 },
+    { G_GUINT64_CONSTANT (0xf6c69a72a3989f5c), 534 }, { G_GUINT64_CONSTANT (0xb7dcbf5354e9bece), 561 },
+    { G_GUINT64_CONSTANT (0x88fcf317f22241e2), 588 }, { G_GUINT64_CONSTANT (0xcc20ce9bd35c78a5), 614 },
+    { G_GUINT64_CONSTANT (0x98165af37b2153df), 641 }, { G_GUINT64_CONSTANT (0xe2a0b5dc971f303a), 667 },
+    { G_GUINT64_CONSTANT (0xa8d9d1535ce3b396), 694 }, { G_GUINT64_CONSTANT (0xfb9b7cd9a4a7443c), 720 },
+    { G_GUINT64_CONSTANT (0xbb764c4ca7a44410), 747 }, { G_GUINT64_CONSTANT (0x8bab8eefb6409c1a), 774 },
+    { G_GUINT64_CONSTANT (0xd01fef10a657842c), 800 }, { G_GUINT64_CONSTANT (0x9b10a4e5e9913129), 827 },
+    { G_GUINT64_CONSTANT (0xe7109bfba19c0c9d), 853 }, { G_GUINT64_CONSTANT (0xac2820d9623bf429), 880 },
+    { G_GUINT64_CONSTANT (0x80444b5e7aa7cf85), 907 }, { G_GUINT64_CONSTANT (0xbf21e44003acdd2d), 933 },
+    { G_GUINT64_CONSTANT (0x8e679c2f5e44ff8f), 960 }, { G_GUINT64_CONSTANT (0xd433179d9c8cb841), 986 },
+    { G_GUINT64_CONSTANT (0x9e19db92b4e31ba9), 1013 }, { G_GUINT64_CONSTANT (0xeb96bf6ebadf77d9), 1039 },
+    { G_GUINT64_CONSTANT (0xaf87023b9bf0ee6b), 1066 },
+};
+
+static const guint64 pow10_u64[] = {
+    G_GUINT64_CONSTANT (1), G_GUINT64_CONSTANT (10),
+    G_GUINT64_CONSTANT (100), G_GUINT64_CONSTANT (1000),
+    G_GUINT64_CONSTANT (10000), G_GUINT64_CONSTANT (100000),
+    G_GUINT64_CONSTANT (1000000), G_GUINT64_CONSTANT (10000000),
+    G_GUINT64_CONSTANT (100000000), G_GUINT64_CONSTANT (1000000000),
+    G_GUINT64_CONSTANT (10000000000), G_GUINT64_CONSTANT (100000000000),
+    G_GUINT64_CONSTANT (1000000000000), G_GUINT64_CONSTANT (10000000000000),
+    G_GUINT64_CONSTANT (100000000000000), G_GUINT64_CONSTANT (1000000000000000),
+    G_GUINT64_CONSTANT (10000000000000000), G_GUINT64_CONSTANT (100000000000000000),
+    G_GUINT64_CONSTANT (1000000000000000000), G_GUINT64_CONSTANT (10000000000000000000)
+};
+
+static const gchar digit_pairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+
+static DiyFp
+_diyfp_mul (DiyFp x, DiyFp y)
+{
+    const guint64 m32 = 0xFFFFFFFFu;
+    guint64 a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+    guint64 ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    guint64 tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+    DiyFp r;
+
+    tmp += G_GUINT64_CONSTANT (1) << 31; /* round */
+    r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+
+static DiyFp
+_diyfp_normalize (DiyFp x)
+{
+    while (!(x.f & (G_GUINT64_CONSTANT (1) << 63))) {
+	x.f <<= 1;
+	x.e--;
+    }
+
+    return x;
+}
+
+
+static DiyFp
+_grisu_cached_power (gint e, gint *k)
+{
+    gdouble dk = (-61 - e) * 0.30102999566398114 + 347;
+    gint ik = (gint) dk;
+    guint index;
+
+    if (dk - ik > 0.0)
+	ik++;
+
+    index = (guint) ((ik >> 3) + 1);
+    *k = -(-348 + (gint) index * 8);
+    return cached_powers[index];
+}
+
+
+static void
+_grisu_round (gchar *buf, gint len, guint64 delta, guint64 rest,
+	      guint64 ten_kappa, guint64 wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+	   (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+	buf[len - 1]--;
+	rest += ten_kappa;
+    }
+}
+
+
+static gint
+_grisu_count_digits (guint32 n)
+{
+    gint i;
+
+    for (i = 1; i < 10; i++)
+	if (n < pow10_u64[i])
+	    return i;
+
+    return 10;
+}
+
+
+static gint
+_grisu_digit_gen (DiyFp w, DiyFp mp, guint64 delta, gchar *buf, gint *k)
+{
+    DiyFp one;
+    guint64 wp_w = mp.f - w.f, p2;
+    guint32 p1;
+    gint kappa, len = 0;
+
+    one.e = mp.e;
+    one.f = G_GUINT64_CONSTANT (1) << -mp.e;
+    p1 = (guint32) (mp.f >> -one.e);
+    p2 = mp.f & (one.f - 1);
+    kappa = _grisu_count_digits (p1);
+
+    while (kappa > 0) {
+	guint32 div = (guint32) pow10_u64[kappa - 1];
+	guint32 d = p1 / div;
+	guint64 tmp;
+
+	p1 %= div;
+
+	if (d || len)
+	    buf[len++] = '0' + d;
+
+	kappa--;
+	tmp = ((guint64) p1 << -one.e) + p2;
+
+	if (tmp <= delta) {
+	    *k += kappa;
+	    _grisu_round (buf, len, delta, tmp, pow10_u64[kappa] << -one.e, wp_w);
+	    return len;
+	}
+    }
+
+    while (TRUE) {
+	gint d;
+
+	p2 *= 10;
+	delta *= 10;
+	d = (gint) (p2 >> -one.e);
+
+	if (d || len)
+	    buf[len++] = '0' + d;
+
+	p2 &= one.f - 1;
+	kappa--;
+
+	if (p2 < delta) {
+	    *k += kappa;
+	    _grisu_round (buf, len, delta, p2, one.f,
+			  wp_w * (-kappa < 20 ? pow10_u64[-kappa] : 0));
+	    return len;
+	}
+    }
+}
+
+
+static gint
+_grisu2 (guint64 f, gint e, gint sigbits, gchar *buf, gint *k)
+{
+    /* @f * 2^@e is a positive value whose significand has @sigbits
+     * explicit bits; the hidden bit is set in @f unless it's
+     * subnormal. Writes the shortest digit string that identifies it
+     * to @buf; the value is those digits times 10^*@k. */
+    guint64 hidden = G_GUINT64_CONSTANT (1) << sigbits;
+    DiyFp v, wp, wm, w, c_mk;
+
+    v.f = f;
+    v.e = e;
+
+    wp.f = (f << 1) + 1;
+    wp.e = e - 1;
+
+    while (!(wp.f & (hidden << 1))) {
+	wp.f <<= 1;
+	wp.e--;
+    }
+
+    wp.f <<= 64 - sigbits - 2;
+    wp.e -= 64 - sigbits - 2;
+
+    if (f == hidden) {
+	wm.f = (f << 2) - 1;
+	wm.e = e - 2;
+    } else {
+	wm.f = (f << 1) - 1;
+	wm.e = e - 1;
+    }
+
+    wm.f <<= wm.e - wp.e;
+    wm.e = wp.e;
+
+    c_mk = _grisu_cached_power (wp.e, k);
+    w = _diyfp_mul (_diyfp_normalize (v), c_mk);
+    wp = _diyfp_mul (wp, c_mk);
+    wm = _diyfp_mul (wm, c_mk);
+    wm.f++;
+    wp.f--;
+    return _grisu_digit_gen (w, wp, wp.f - wm.f, buf, k);
+}
+
+
+static gsize
+_format_exponent (gint e, gchar *buf)
+{
+    gchar *p = buf;
+
+    /* Like printf: a sign and at least two digits. */
+
+    *p++ = 'e';
+
+    if (e < 0) {
+	*p++ = '-';
+	e = -e;
+    } else
+	*p++ = '+';
+
+    if (e >= 100) {
+	*p++ = '0' + e / 100;
+	e %= 100;
+    }
+
+    memcpy (p, digit_pairs + 2 * e, 2);
+    return p + 2 - buf;
+}
+
+
+static gsize
+_format_digits (gchar *digits, gint len, gint k, gchar *buf)
+{
+    gint kk = len + k; /* the value is 0.digits * 10^kk */
+    gchar *p = buf;
+
+    if (k >= 0 && kk <= 17) {
+	/* An integer: 1234e7 -> 12340000000 */
+	memcpy (p, digits, len);
+	memset (p + len, '0', k);
+	p += kk;
+    } else if (kk > 0 && kk <= 17) {
+	/* 1234e-2 -> 12.34 */
+	memcpy (p, digits, kk);
+	p[kk] = '.';
+	memcpy (p + kk + 1, digits + kk, len - kk);
+	p += len + 1;
+    } else if (kk > -6 && kk <= 0) {
+	/* 1234e-6 -> 0.001234 */
+	*p++ = '0';
+	*p++ = '.';
+	memset (p, '0', -kk);
+	memcpy (p - kk, digits, len);
+	p += len - kk;
+    } else {
+	/* 1234e30 -> 1.234e+33 */
+	*p++ = digits[0];
+
+	if (len > 1) {
+	    *p++ = '.';
+	    memcpy (p, digits + 1, len - 1);
+	    p += len - 1;
+	}
+
+	p += _format_exponent (kk - 1, p);
+    }
+
+    *p = '\0';
+    return p - buf;
+}
+
+
+static gsize
+_format_special (gboolean neg, gboolean nan, gboolean inf, gchar *buf)
+{
+    gchar *p = buf;
+
+    if (neg)
+	*p++ = '-';
+
+    if (nan)
+	memcpy (p, "nan", 4);
+    else if (inf)
+	memcpy (p, "inf", 4);
+    else
+	memcpy (p, "0", 2);
+
+    return strlen (buf);
+}
+
+
+gsize
+ds_format_f64 (gdouble val, gchar *buf)
+{
+    union { gdouble d; guint64 u; } x;
+    guint64 f;
+    gint be, k, len;
+    gchar digits[20], *p = buf;
+
+    /* @buf must hold at least DS_FORMAT_MAX_NUMLEN bytes. The text is
+     * nul-terminated, and the return value is its length. */
+
+    x.d = val;
+    f = x.u & ((G_GUINT64_CONSTANT (1) << 52) - 1);
+    be = (gint) ((x.u >> 52) & 0x7FF);
+
+    if (be == 0x7FF || (be == 0 && f == 0))
+	return _format_special ((x.u >> 63) && !(be == 0x7FF && f != 0),
+				be == 0x7FF && f != 0, be == 0x7FF, buf);
+
+    if (x.u >> 63)
+	*p++ = '-';
+
+    if (be != 0)
+	len = _grisu2 (f | (G_GUINT64_CONSTANT (1) << 52), be - 1075, 52, digits, &k);
+    else
+	len = _grisu2 (f, 1 - 1075, 52, digits, &k);
+
+    return p - buf + _format_digits (digits, len, k, p);
+}
+
+
+gsize
+ds_format_f32 (gfloat val, gchar *buf)
+{
+    union { gfloat f; guint32 u; } x;
+    guint64 f;
+    gint be, k, len;
+    gchar digits[20], *p = buf;
+
+    /* As ds_format_f64(), but the digits identify the value among
+     * floats, so 0.1f comes out as 0.1, not 0.10000000149011612. */
+
+    x.f = val;
+    f = x.u & ((1u << 23) - 1);
+    be = (gint) ((x.u >> 23) & 0xFF);
+
+    if (be == 0xFF || (be == 0 && f == 0))
+	return _format_special ((x.u >> 31) && !(be == 0xFF && f != 0),
+				be == 0xFF && f != 0, be == 0xFF, buf);
+
+    if (x.u >> 31)
+	*p++ = '-';
+
+    if (be != 0)
+	len = _grisu2 (f | (1u << 23), be - 150, 23, digits, &k);
+    else
+	len = _grisu2 (f, 1 - 150, 23, digits, &k);
+
+    return p - buf + _format_digits (digits, len, k, p);
+}
+
+
+gsize
+ds_format_i64 (gint64 val, gchar *buf)
+{
+    gchar tmp[24], *p = tmp + sizeof (tmp);
+    guint64 u = val < 0 ? -(guint64) val : (guint64) val;
+    gsize n;
+
+    while (u >= 100) {
+	p -= 2;
+	memcpy (p, digit_pairs + 2 * (u % 100), 2);
+	u /= 100;
+    }
+
+    if (u >= 10) {
+	p -= 2;
+	memcpy (p, digit_pairs + 2 * u, 2);
+    } else
+	*--p = '0' + (gchar) u;
+
+    if (val < 0)
+	*--p = '-';
+
+    n = tmp + sizeof (tmp) - p;
+    memcpy (buf, p, n);
+    buf[n] = '\0';
+    return n;
+}
+
+
+/* Writing whole arrays. */
+
+#define DS_FORMAT_CHUNK 8192
+
+typedef struct _DSFormatSink {
+    gchar buf[DS_FORMAT_CHUNK];
+    gsize len;
+    GString *str;
+    FILE *f;
+    int errnum;
+} DSFormatSink;
+
+
+static void
+_ds_sink_write (DSFormatSink *sink, const gchar *text, gsize n)
+{
+    if (sink->str != NULL)
+	g_string_append_len (sink->str, text, n);
+    else if (sink->errnum == 0 && fwrite (text, 1, n, sink->f) != n)
+	sink->errnum = errno ? errno : EIO;
+}
+
+
+static void
+_ds_sink_flush (DSFormatSink *sink)
+{
+    if (sink->len == 0)
+	return;
+
+    _ds_sink_write (sink, sink->buf, sink->len);
+    sink->len = 0;
+}
+
+
+static inline gchar *
+_ds_sink_reserve (DSFormatSink *sink, gsize n)
+{
+    if (sink->len + n > DS_FORMAT_CHUNK)
+	_ds_sink_flush (sink);
+
+    return sink->buf + sink->len;
+}
+
+
+static inline void
+_ds_sink_put (DSFormatSink *sink, const gchar *text, gsize n)
+{
+    if (n > DS_FORMAT_CHUNK / 2) {
+	/* Not worth copying through the chunk. */
+	_ds_sink_flush (sink);
+	_ds_sink_write (sink, text, n);
+	return;
+    }
+
+    memcpy (_ds_sink_reserve (sink, n), text, n);
+    sink->len += n;
+}
+
+#define _ds_sink_puts(sink, text) _ds_sink_put (sink, text, sizeof (text) - 1)
+
+
+static void
+_ds_sink_text (DSFormatSink *sink, const gchar *text, gsize n,
+	       DSFormatStyle style)
+{
+    gsize i;
+
+    _ds_sink_puts (sink, "\"");
+
+    for (i = 0; i < n; i++) {
+	guchar c = text[i];
+	gchar *p = _ds_sink_reserve (sink, 6);
+
+	if (style == DS_FORMAT_CSV && c == '"') {
+	    /* RFC 4180 doubles embedded quotes. */
+	    p[0] = p[1] = '"';
+	    sink->len += 2;
+	} else if (style == DS_FORMAT_JSON && (c == '"' || c == '\\')) {
+	    p[0] = '\\';
+	    p[1] = c;
+	    sink->len += 2;
+	} else if (style == DS_FORMAT_JSON && c < 0x20) {
+	    memcpy (p, "\\u00", 4);
+	    p[4] = "0123456789abcdef"[c >> 4];
+	    p[5] = "0123456789abcdef"[c & 0xF];
+	    sink->len += 6;
+	} else {
+	    p[0] = c;
+	    sink->len++;
+	}
+    }
+
+    _ds_sink_puts (sink, "\"");
+}
+
+
+static inline void
+_ds_sink_float (DSFormatSink *sink, gdouble val, gboolean is_f32,
+		gboolean plus, DSFormatStyle style)
+{
+    gchar *p = _ds_sink_reserve (sink, DS_FORMAT_MAX_NUMLEN + 1);
+
+    /* JSON has no way to spell NaN or infinity. */
+
+    if (style == DS_FORMAT_JSON && !isfinite (val)) {
+	memcpy (p, "null", 4);
+	sink->len += 4;
+	return;
+    }
+
+    if (plus && !signbit (val)) {
+	*p++ = '+';
+	sink->len++;
+    }
+
+    if (is_f32)
+	sink->len += ds_format_f32 ((gfloat) val, p);
+    else
+	sink->len += ds_format_f64 (val, p);
+}
+
+
+static void
+_ds_format_values (DSFormatSink *sink, gconstpointer data, DSType type,
+		   gssize nvals, DSFormatStyle style)
+{
+    const gchar *d = data;
+    gboolean bracket;
+    gssize i;
+
+    g_assert (nvals >= 0);
+    g_assert (DST_VALID (type));
+
+    if (nvals == 0 && style == DS_FORMAT_PLAIN) {
+	_ds_sink_puts (sink, "<>");
+	return;
+    }
+
+    if (type == DST_TEXT) {
+	if (style == DS_FORMAT_PLAIN) {
+	    _ds_sink_puts (sink, "\"");
+	    _ds_sink_put (sink, d, nvals);
+	    _ds_sink_puts (sink, "\"");
+	} else
+	    _ds_sink_text (sink, d, nvals, style);
+	return;
+    }
+
+    if (nvals == 0) {
+	if (style == DS_FORMAT_JSON)
+	    _ds_sink_puts (sink, "[]");
+	return;
+    }
+
+    bracket = (nvals > 1 && style != DS_FORMAT_CSV);
+
+    if (bracket)
+	_ds_sink_puts (sink, "[");
+
+    for (i = 0; i < nvals; i++) {
+	if (i > 0) {
+	    if (style == DS_FORMAT_PLAIN)
+		_ds_sink_puts (sink, ", ");
+	    else
+		_ds_sink_puts (sink, ",");
+	}
+
+	switch (type) {
+	case DST_BIN:
+	    if (style == DS_FORMAT_JSON)
+		_ds_sink_puts (sink, "null");
+	    else
+		_ds_sink_puts (sink, "?");
+	    break;
+	case DST_I8:
+	    sink->len += ds_format_i64 (*(gint8 *) d, _ds_sink_reserve (sink, 24));
+	    break;
+	case DST_I16:
+	    sink->len += ds_format_i64 (*(gint16 *) d, _ds_sink_reserve (sink, 24));
+	    break;
+	case DST_I32:
+	    sink->len += ds_format_i64 (*(gint32 *) d, _ds_sink_reserve (sink, 24));
+	    break;
+	case DST_I64:
+	    sink->len += ds_format_i64 (*(gint64 *) d, _ds_sink_reserve (sink, 24));
+	    break;
+	case DST_F32:
+	    _ds_sink_float (sink, *(gfloat *) d, TRUE, FALSE, style);
+	    break;
+	case DST_F64:
+	    _ds_sink_float (sink, *(gdouble *) d, FALSE, FALSE, style);
+	    break;
+	case DST_C64:
+	    /* re+imi, as a [re,im] pair in JSON, and as two fields in CSV. */
+	    if (style == DS_FORMAT_JSON)
+		_ds_sink_puts (sink, "[");
+	    _ds_sink_float (sink, ((gfloat *) d)[0], TRUE, FALSE, style);
+	    if (style != DS_FORMAT_PLAIN)
+		_ds_sink_puts (sink, ",");
+	    _ds_sink_float (sink, ((gfloat *) d)[1], TRUE,
+			    style == DS_FORMAT_PLAIN, style);
+	    if (style == DS_FORMAT_PLAIN)
+		_ds_sink_puts (sink, "i");
+	    else if (style == DS_FORMAT_JSON)
+		_ds_sink_puts (sink, "]");
+	    break;
+	default:
+	    g_assert_not_reached ();
+	}
+
+	d += ds_type_sizes[type];
+    }
+
+    if (bracket)
+	_ds_sink_puts (sink, "]");
+}
+
+
+void
+ds_format_values (GString *dest, gconstpointer data, DSType type,
+		  gssize nvals, DSFormatStyle style)
+{
+    DSFormatSink sink;
+
+    /* Appends to @dest. */
+
+    sink.len = 0;
+    sink.str = dest;
+    sink.f = NULL;
+    sink.errnum = 0;
+
+    _ds_format_values (&sink, data, type, nvals, style);
+    _ds_sink_flush (&sink);
+}
+
+
+gboolean
+ds_format_values_to_file (FILE *f, gconstpointer data, DSType type,
+			  gssize nvals, DSFormatStyle style, GError **err)
+{
+    DSFormatSink sink;
+
+    sink.len = 0;
+    sink.str = NULL;
+    sink.f = f;
+    sink.errnum = 0;
+
+    _ds_format_values (&sink, data, type, nvals, style);
+    _ds_sink_flush (&sink);
+
+    if (sink.errnum == 0)
+	return FALSE;
+
+    g_set_error (err, G_FILE_ERROR, g_file_error_from_errno (sink.errnum),
+		 "Failed to write formatted values: %s", g_strerror (sink.errnum));
+    return TRUE;
+}
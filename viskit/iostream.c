@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* O_DIRECT */
+#endif
+
 #include <iostream.h>
 
 #ifdef HAVE_CONFIG_H
@@ -11,141 +15,108 @@
 #include <errno.h>
 #include <unistd.h>
 #include <string.h> /*memcpy*/
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <sys/syscall.h> /* copy_file_range, splice */
+#endif
+
+/* Older C libraries don't know the io_uring syscall numbers even when
+ * the kernel headers describe the interface. */
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__linux__) && \
+    defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define IO_HAVE_URING
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
 
 
 #define DEFAULT_BUFSZ 16384
 
+/* O_DIRECT transfers must be aligned, in memory and in the file, to
+ * the device's logical block size. This is as large as that gets. */
+#define IO_DIRECT_ALIGN 4096
+#if IO_BUF_ALIGN < IO_DIRECT_ALIGN
+#error "pool buffers aren't aligned enough for O_DIRECT"
+#endif
+#define IO_DIRECT_ALIGNED(ofs, n) \
+    ((((guint64) (ofs) | (guint64) (n)) & (IO_DIRECT_ALIGN - 1)) == 0)
+
+/* How far IO_HINT_SEQUENTIAL reads ahead on its own account, and how
+ * much IO_HINT_DONTNEED lets build up behind the cursor before
+ * evicting it. */
+#define IO_HINT_WINDOW (8 << 20)
+
 static gssize _io_fd_read (int fd, gpointer buf, gsize nbytes, GError **err);
 static gboolean _io_fd_write (int fd, gconstpointer buf, gsize nbytes,
 			      GError **err);
+static gssize _io_fd_pread (int fd, gpointer buf, gsize nbytes, goffset ofs,
+			    GError **err);
 static gboolean _io_read (IOStream *io, GError **err);
 static gboolean _io_write (IOStream *io, GError **err);
-
-
-/* Dealing with endianness conversion: MIRIAD datasets are
- * standardized to big-endian */
-
-typedef union _IOBufptr {
-    gpointer any;
-    gint8 *i8;
-    gint16 *i16;
-    gint32 *i32;
-    gint64 *i64;
-    gfloat *f32;
-    gdouble *f64;
-    vkcomplex64 *c64;
-    gchar *text;
-} IOBufptr;
-
-typedef union _IOConstBufptr {
-    gconstpointer any;
-    const gint8 *i8;
-    const gint16 *i16;
-    const gint32 *i32;
-    const gint64 *i64;
-    const gfloat *f32;
-    const gdouble *f64;
-    const vkcomplex64 *c64;
-    const gchar *text;
-} IOConstBufptr;
-
-void
-io_recode_data_copy (const gchar *src, gchar *dest, DSType type, gsize nvals)
-{
-    gsize i;
-    IOConstBufptr bsrc;
-    IOBufptr bdest;
-
-    bsrc.any = src;
-    bdest.any = dest;
-
-    switch (type) {
-    case DST_BIN:
-    case DST_I8:
-    case DST_TEXT:
-	memcpy (dest, src, nvals);
-	break;
-    case DST_I16:
-	for (i = 0; i < nvals; i++) {
-	    *(bdest.i16) = GINT16_FROM_BE(*(bsrc.i16));
-	    bdest.i16++;
-	    bsrc.i16++;
-	}
-	break;
-    case DST_C64:
-	nvals *= 2;
-	/* fall through */
-    case DST_I32:
-    case DST_F32:
-	for (i = 0; i < nvals; i++) {
-	    *(bdest.i32) = GINT32_FROM_BE(*(bsrc.i32));
-	    bdest.i32++;
-	    bsrc.i32++;
-	}
-	break;
-    case DST_I64:
-    case DST_F64:
-	for (i = 0; i < nvals; i++) {
-	    *(bdest.i64) = GINT64_FROM_BE(*(bsrc.i64));
-	    bdest.i64++;
-	    bsrc.i64++;
-	}
-	break;
-    default:
-	g_error ("Unhandled data typecode %d!", type);
-	break;
-    }
-}
-
-void
-io_recode_data_inplace (gchar *data, DSType type, gsize nvals)
-{
-    gsize i;
-    IOBufptr bdata;
-
-    bdata.any = data;
-
-    switch (type) {
-    case DST_BIN:
-    case DST_I8:
-    case DST_TEXT:
-	break;
-    case DST_I16:
-	for (i = 0; i < nvals; i++) {
-	    *(bdata.i16) = GINT16_FROM_BE(*(bdata.i16));
-	    bdata.i16++;
-	}
-	break;
-    case DST_C64:
-	nvals *= 2;
-	/* fall through */
-    case DST_I32:
-    case DST_F32:
-	for (i = 0; i < nvals; i++) {
-	    *(bdata.i32) = GINT32_FROM_BE(*(bdata.i32));
-	    bdata.i32++;
-	}
-	break;
-    case DST_I64:
-    case DST_F64:
-	for (i = 0; i < nvals; i++) {
-	    *(bdata.i64) = GINT64_FROM_BE(*(bdata.i64));
-	    bdata.i64++;
-	}
-	break;
-    default:
-	g_error ("Unhandled data typecode %d!", type);
-	break;
-    }
-}
+static gboolean _io_write_span (IOStream *io, const gchar *buf, goffset bufofs,
+				gsize from, gsize to, GError **err);
+static gboolean _io_rw_writeback (IOStream *io, GError **err);
+static void _io_drop_behind (IOStream *io, goffset ofs);
+static void _io_readahead_free (IOStream *io);
+static void _io_writebehind_free (IOStream *io);
+static gboolean _io_writebehind_drain (IOStream *io, GError **err);
+static void _io_uring_free (IOStream *io);
+static gboolean _io_uring_restart (IOStream *io, goffset ofs, GError **err);
+static gboolean _io_uring_flush (IOStream *io, GError **err);
 
 
 /* Actual I/O operations. */
 
+typedef struct _IOReadahead {
+    /* State shared with the read-ahead thread. The consumer owns the
+     * slot it was most recently handed (if @held) until it asks for
+     * the next one; the thread fills the free slots in ring order. */
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    guint nslots;
+    gchar **bufs;
+    gsize *nread; /* amount of data in each filled slot */
+    guint head; /* next filled slot to hand to the consumer */
+    guint nfilled; /* number of filled, unconsumed slots */
+    gboolean held; /* is the consumer holding the slot before head? */
+    gboolean done; /* has the thread hit EOF or an error? */
+    gboolean quit; /* should the thread exit? */
+    GError *err; /* error encountered by the thread, if any */
+} IOReadahead;
+
+typedef struct _IOWriteBehind {
+    /* State shared with the write-behind thread. The writer owns the
+     * slot after the last queued one; the thread writes the queued
+     * slots in order, and a slot stays queued until it's been
+     * written. */
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    guint nslots;
+    gchar **bufs;
+    goffset *offsets; /* file offset of each queued slot's block */
+    gsize *from, *to; /* part of each queued slot to write */
+    guint head; /* next queued slot to write */
+    guint nqueued; /* number of queued slots */
+    gboolean quit; /* should the thread exit? */
+    gint failed; /* has the thread stopped on an error? (atomic) */
+    GError *err; /* error encountered by the thread, if any */
+} IOWriteBehind;
+
+typedef struct _IOUring IOUring;
+
 struct _IOStream {
     IOMode mode;
     int fd;
     gsize bufsz;
+    IOUring *uring; /* non-NULL if using the io_uring engine */
+    gboolean direct; /* is the fd in O_DIRECT mode? */
+    IOAccessHint hint;
+    goffset hintofs; /* DONTNEED: start of the window not yet evicted */
+    goffset dropofs; /* DONTNEED, writes: start of the window being written back */
 
     union {
 	struct {
@@ -153,40 +124,136 @@ struct _IOStream {
 	    gchar *scratch; /* for block-crossing read requests. */
 	    gsize curpos; /* position of read cursor within buffer. */
 	    gsize endpos; /* location of EOF within the buffer */
+	    goffset bufofs; /* file offset of the start of buf */
+	    gsize startpos; /* where the next block read starts in buf */
+	    gsize dirtylo, dirtyhi; /* modified part of buf (read-write only) */
 	    gboolean eof; /* have we read to EOF? */
+	    gboolean mapped; /* is buf an mmap of the whole file? */
+	    gsize scratchsz; /* size of scratch */
+	    IOReadahead *ra; /* non-NULL if reading ahead in a thread */
 	} read;
 	struct {
 	    gchar *buf;
 	    gsize curpos; /* position of read cursor within buffer. */
+	    goffset bufofs; /* file offset of the start of buf */
+	    gsize startpos; /* start of data in buf not yet in the file */
+	    IOWriteBehind *wb; /* non-NULL if writing in a thread */
 	} write;
     } s; /* short for "state" */
 };
 
 
+static void
+_io_direct_set (IOStream *io, gboolean on)
+{
+    int fl;
+
+    /* Switch a direct stream's fd in or out of O_DIRECT, for the
+     * occasional transfer that it can't do. The flags belong to the
+     * whole fd, so nothing else may be doing I/O on it meanwhile:
+     * callers stop or drain any helper thread first, or are the
+     * helper thread. */
+
+#ifdef O_DIRECT
+    if (!io->direct || (fl = fcntl (io->fd, F_GETFL)) < 0)
+	return;
+
+    fcntl (io->fd, F_SETFL, on ? (fl | O_DIRECT) : (fl & ~O_DIRECT));
+#endif
+}
+
+
+static goffset
+_io_fd_offset (int fd, goffset align_hint)
+{
+    struct stat statbuf;
+    goffset ofs;
+    int fl;
+
+    /* Where is @fd? Writes to O_APPEND descriptors go to the end of
+     * the file regardless of the file position. If the FD isn't
+     * seekable, all we can know is what the caller told us. */
+
+    fl = fcntl (fd, F_GETFL);
+
+    if (fl >= 0 && (fl & O_APPEND) && (fl & O_ACCMODE) != O_RDONLY &&
+	fstat (fd, &statbuf) == 0 && S_ISREG (statbuf.st_mode))
+	return statbuf.st_size;
+
+    if ((ofs = lseek (fd, 0, SEEK_CUR)) < 0)
+	return align_hint;
+
+    return ofs;
+}
+
+
+static void
+_io_seed_write_buffer (IOStream *io)
+{
+    gsize ntail = io->s.write.curpos;
+    gsize nread = 0;
+    gssize n;
+    int fl;
+
+    /* We've been positioned partway into a block, e.g. to append to an
+     * existing file. If we can read the part of the block that's
+     * already in the file, and we can write at arbitrary offsets, put
+     * it into the buffer and back up so that every write we make is a
+     * whole, aligned block. Otherwise we'll just write the first
+     * partial block short. */
+
+    fl = fcntl (io->fd, F_GETFL);
+
+    if (fl < 0 || (fl & O_APPEND) || (fl & O_ACCMODE) != O_RDWR ||
+	io->s.write.bufofs < 0)
+	return;
+
+    while (nread < ntail) {
+	n = pread (io->fd, io->s.write.buf + nread, ntail - nread,
+		   io->s.write.bufofs + nread);
+
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return;
+
+	nread += n;
+    }
+
+    if (lseek (io->fd, io->s.write.bufofs, SEEK_SET) < 0) {
+	/* Try not to leave the file position messed up. */
+	lseek (io->fd, io->s.write.bufofs + ntail, SEEK_SET);
+	return;
+    }
+
+    io->s.write.startpos = 0;
+}
+
+
 IOStream *
 io_new_from_fd (IOMode mode, int fd, gsize bufsz, goffset align_hint)
 {
     IOStream *io;
+    goffset ofs;
 
     if (bufsz == 0)
 	bufsz = DEFAULT_BUFSZ;
 
-    /* align_hint will be used to tell the IOStream of the alignment of
-     * the FD handle within its stream. It's 0 if starting at the
-     * beginning of a file, but if we're appending one, for instance,
-     * it will be different. The align_hint should be reduced via modulus
-     * to a small-ish number, specifically one smaller than bufsz.
-     *
-     * FIXME: currently ignored.
-     */
-
-    g_assert (align_hint == 0); /* !!!! temporary */
+    /* align_hint tells the IOStream of the alignment of the FD handle
+     * within its stream. It's 0 if starting at the beginning of a
+     * file, but if we're appending one, for instance, it will be
+     * different. Only its value modulo bufsz matters, so callers can
+     * just pass the file offset. We use it to keep our buffers aligned
+     * with whole blocks of the file, which io_nudge_align() relies
+     * upon. */
 
     /* bufsz must be a multiple of a large power of 2, say 256 ... */
     g_assert ((bufsz & 0xFF) == 0);
-    g_assert (align_hint < bufsz);
+    g_assert (align_hint >= 0);
     g_assert (fd >= 0);
 
+    align_hint %= bufsz;
+
     io = g_new0 (IOStream, 1);
     io->mode = mode;
     io->fd = fd;
@@ -194,16 +261,32 @@ io_new_from_fd (IOMode mode, int fd, gsize bufsz, goffset align_hint)
 
     switch (mode) {
     case IO_MODE_READ:
-	/* Allocate the two buffers as one block. */
-	io->s.read.buf = g_new (gchar, bufsz * 2);
-	io->s.read.scratch = io->s.read.buf + bufsz;
+    case IO_MODE_READ_WRITE:
+	/* A read-write stream is a read stream whose buffer can be
+	 * modified; see _io_rw_write(). The scratch buffer grows as
+	 * needed. */
+	io->s.read.buf = io_buf_alloc (bufsz);
+	io->s.read.scratch = io_buf_alloc (bufsz);
+	io->s.read.scratchsz = bufsz;
 	io->s.read.eof = FALSE;
 	io->s.read.curpos = bufsz; /* Forces a block to be read on first read */
 	io->s.read.endpos = 0;
+	/* Buffers are always block-aligned within the file. The first
+	 * read will advance us to the block containing the FD position,
+	 * and fill it starting at that position. */
+	ofs = _io_fd_offset (fd, align_hint);
+	io->s.read.bufofs = ofs - align_hint - (goffset) bufsz;
+	io->s.read.startpos = align_hint;
 	break;
     case IO_MODE_WRITE:
-	io->s.write.buf = g_new (gchar, bufsz);
-	io->s.write.curpos = 0;
+	io->s.write.buf = io_buf_alloc (bufsz);
+	io->s.write.curpos = align_hint;
+	io->s.write.startpos = align_hint;
+	ofs = _io_fd_offset (fd, align_hint);
+	io->s.write.bufofs = ofs - align_hint;
+
+	if (align_hint != 0)
+	    _io_seed_write_buffer (io);
 	break;
     default:
 	/* Unsupported stream mode: we only do read or write but not both. */
@@ -215,20 +298,90 @@ io_new_from_fd (IOMode mode, int fd, gsize bufsz, goffset align_hint)
 }
 
 
+IOStream *
+io_new_mapped_from_fd (int fd, GError **err)
+{
+    IOStream *io;
+    struct stat statbuf;
+    gpointer map = NULL;
+
+    /* A mapped stream looks like a read stream whose buffer holds the
+     * entire file and which has already hit EOF, so the EOF branches
+     * of the read routines hand out pointers straight into the
+     * mapping. On failure, @fd is left open so that the caller can
+     * fall back to io_new_from_fd(). */
+
+    g_assert (fd >= 0);
+
+    if (fstat (fd, &statbuf)) {
+	IO_ERRNO_ERR (err, errno, "Failed to stat stream for mapping");
+	return NULL;
+    }
+
+    if (!S_ISREG (statbuf.st_mode) || statbuf.st_size > G_MAXSIZE) {
+	IO_ERRNO_ERR (err, EINVAL, "Failed to map stream");
+	return NULL;
+    }
+
+    if (statbuf.st_size > 0) {
+	map = mmap (NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED) {
+	    IO_ERRNO_ERR (err, errno, "Failed to map stream");
+	    return NULL;
+	}
+
+	/* Purely advisory, so ignore failures. */
+	madvise (map, statbuf.st_size, MADV_SEQUENTIAL);
+    }
+
+    io = g_new0 (IOStream, 1);
+    io->mode = IO_MODE_READ;
+    io->fd = fd;
+    io->bufsz = DEFAULT_BUFSZ;
+    io->s.read.buf = map;
+    io->s.read.scratch = NULL;
+    io->s.read.scratchsz = 0;
+    io->s.read.curpos = 0;
+    io->s.read.endpos = statbuf.st_size;
+    io->s.read.bufofs = 0;
+    io->s.read.eof = TRUE;
+    io->s.read.mapped = TRUE;
+    return io;
+}
+
+
 void
 io_free (IOStream *io)
 {
     if (io == NULL)
 	return;
 
+    if (io->uring != NULL)
+	/* buf points into one of the ring's slots. */
+	_io_uring_free (io);
+
     switch (io->mode) {
     case IO_MODE_READ:
-	g_free (io->s.read.buf);
+    case IO_MODE_READ_WRITE:
+	if (io->s.read.ra != NULL)
+	    /* buf points into one of the read-ahead slots. */
+	    _io_readahead_free (io);
+	else if (!io->s.read.mapped)
+	    io_buf_free (io->s.read.buf, io->bufsz);
+	else if (io->s.read.buf != NULL)
+	    munmap (io->s.read.buf, io->s.read.endpos);
+
+	io_buf_free (io->s.read.scratch, io->s.read.scratchsz);
 	io->s.read.buf = NULL;
 	io->s.read.scratch = NULL;
 	break;
     case IO_MODE_WRITE:
-	g_free (io->s.write.buf);
+	if (io->s.write.wb != NULL)
+	    /* buf points into one of the write-behind slots. */
+	    _io_writebehind_free (io);
+	else
+	    io_buf_free (io->s.write.buf, io->bufsz);
 	io->s.write.buf = NULL;
 	break;
     default:
@@ -249,15 +402,29 @@ io_close_and_free (IOStream *io, GError **err)
 	return FALSE;
 
     if (io->fd >= 0) {
-	if (io->mode == IO_MODE_WRITE) {
+	if (io->mode == IO_MODE_WRITE && io->uring != NULL) {
+	    /* Flush and wait for everything in flight. */
+	    if (_io_uring_flush (io, err))
+		retval = TRUE;
+	} else if (io->mode == IO_MODE_WRITE && io->s.write.wb != NULL) {
+	    /* Likewise. */
+	    if (_io_writebehind_drain (io, err))
+		retval = TRUE;
+	} else if (io->mode == IO_MODE_WRITE) {
 	    /* Any pending writes to flush? */
 
-	    if (io->s.write.curpos != 0) {
-		if (_io_fd_write (io->fd, io->s.write.buf, io->s.write.curpos, err))
+	    if (io->s.write.curpos > io->s.write.startpos) {
+		if (_io_write_span (io, io->s.write.buf, io->s.write.bufofs,
+				    io->s.write.startpos, io->s.write.curpos, err))
 		    retval = TRUE;
 	    }
+	} else if (io->mode == IO_MODE_READ_WRITE) {
+	    if (_io_rw_writeback (io, err))
+		retval = TRUE;
 	}
 
+	_io_drop_behind (io, -1);
+
 	if (close (io->fd)) {
 	    IO_ERRNO_ERR (err, errno, "Failed to close stream");
 	    retval = TRUE;
@@ -269,6 +436,152 @@ io_close_and_free (IOStream *io, GError **err)
 }
 
 
+gboolean
+io_enable_direct (IOStream *io, GError **err)
+{
+#ifdef O_DIRECT
+    int fl;
+
+    /* Only valid on a fresh buffered stream, before any other engine
+     * is enabled. If the filesystem doesn't do direct I/O, we stay in
+     * the page cache. Block reads at EOF just come up short, and
+     * writes that aren't whole blocks (the partial ones at either end
+     * of the file) are done without O_DIRECT, so callers don't need to
+     * worry about either. */
+
+    g_assert (io->mode != IO_MODE_READ_WRITE);
+    g_assert (io->uring == NULL && !io->direct);
+    g_assert (io->bufsz % IO_DIRECT_ALIGN == 0);
+
+    if (io->mode == IO_MODE_READ) {
+	g_assert (!io->s.read.mapped && io->s.read.ra == NULL);
+	g_assert (!io->s.read.eof && io->s.read.curpos == io->bufsz);
+    } else
+	g_assert (io->s.write.wb == NULL);
+
+    if ((fl = fcntl (io->fd, F_GETFL)) < 0) {
+	IO_ERRNO_ERR (err, errno, "Failed to query stream flags");
+	return TRUE;
+    }
+
+    if (fcntl (io->fd, F_SETFL, fl | O_DIRECT))
+	return FALSE;
+
+    /* Reads have to start at the beginning of a block; _io_read() skips
+     * to where we actually are. */
+
+    if (io->mode == IO_MODE_READ && io->s.read.startpos != 0 &&
+	lseek (io->fd, io->s.read.bufofs + io->bufsz, SEEK_SET) < 0) {
+	fcntl (io->fd, F_SETFL, fl);
+	return FALSE;
+    }
+
+    /* Our buffers are already suitably aligned. */
+    io->direct = TRUE;
+#endif
+    return FALSE;
+}
+
+
+/* Access hints. These are purely advisory, so failures are ignored. */
+
+void
+io_set_access_hint (IOStream *io, IOAccessHint hint)
+{
+#ifdef POSIX_FADV_NORMAL
+    static const int fadv[] = {
+	POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM,
+	POSIX_FADV_WILLNEED, POSIX_FADV_SEQUENTIAL
+    };
+#endif
+    static const int madv[] = {
+	MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED,
+	MADV_SEQUENTIAL
+    };
+    goffset ofs;
+
+    g_assert (hint >= IO_HINT_NORMAL && hint <= IO_HINT_DONTNEED);
+
+    if ((io->mode & IO_MODE_READ) && io->s.read.mapped) {
+	/* The whole file is already in view, so DONTNEED is moot. */
+	if (io->s.read.endpos > 0)
+	    madvise (io->s.read.buf, io->s.read.endpos, madv[hint]);
+	io->hint = hint;
+	return;
+    }
+
+    /* Where the data we've yet to deal with start. For writes, that's
+     * the data we haven't yet handed to the kernel. */
+
+    if (io->mode & IO_MODE_READ)
+	ofs = io_tell (io);
+    else
+	ofs = io->s.write.bufofs + io->s.write.startpos;
+
+    io->hint = hint;
+    io->hintofs = io->dropofs = MAX (ofs, 0);
+
+#ifdef POSIX_FADV_NORMAL
+    posix_fadvise (io->fd, 0, 0, fadv[hint]);
+
+    if (!(io->mode & IO_MODE_READ) || ofs < 0)
+	return;
+
+    if (hint == IO_HINT_SEQUENTIAL)
+	/* Get things going before our first read. */
+	posix_fadvise (io->fd, ofs, IO_HINT_WINDOW, POSIX_FADV_WILLNEED);
+    else if (hint == IO_HINT_WILLNEED)
+	posix_fadvise (io->fd, ofs, 0, POSIX_FADV_WILLNEED);
+#endif
+}
+
+
+static void
+_io_drop_behind (IOStream *io, goffset ofs)
+{
+    /* Under IO_HINT_DONTNEED, evict the data behind @ofs from the page
+     * cache, a window at a time; @ofs < 0 means everything, since
+     * we're closing. Dirty pages can't be evicted, so when writing we
+     * start writeback on each window as we pass it and evict it once
+     * we're a window further on, when it has usually finished. */
+
+#ifdef POSIX_FADV_DONTNEED
+    if (io->hint != IO_HINT_DONTNEED ||
+	((io->mode & IO_MODE_READ) && io->s.read.mapped))
+	return;
+
+    if (ofs >= 0 && ofs - io->hintofs < IO_HINT_WINDOW)
+	return;
+
+    if (io->mode == IO_MODE_WRITE) {
+#ifdef SYNC_FILE_RANGE_WRITE
+	if (ofs < 0)
+	    sync_file_range (io->fd, io->dropofs, 0, SYNC_FILE_RANGE_WAIT_BEFORE |
+			     SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	else {
+	    sync_file_range (io->fd, io->hintofs, ofs - io->hintofs,
+			     SYNC_FILE_RANGE_WRITE);
+
+	    if (io->hintofs > io->dropofs)
+		sync_file_range (io->fd, io->dropofs, io->hintofs - io->dropofs,
+				 SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+				 SYNC_FILE_RANGE_WAIT_AFTER);
+	}
+#endif
+
+	if (ofs < 0 || io->hintofs > io->dropofs)
+	    posix_fadvise (io->fd, io->dropofs, ofs < 0 ? 0 : io->hintofs - io->dropofs,
+			   POSIX_FADV_DONTNEED);
+	io->dropofs = io->hintofs;
+    } else
+	posix_fadvise (io->fd, io->hintofs, ofs < 0 ? 0 : ofs - io->hintofs,
+		       POSIX_FADV_DONTNEED);
+
+    io->hintofs = ofs;
+#endif
+}
+
+
 int
 io_get_fd (IOStream *io)
 {
@@ -328,48 +641,1233 @@ _io_fd_write (int fd, gconstpointer buf, gsize nbytes, GError **err)
 }
 
 
+static gssize
+_io_fd_pread (int fd, gpointer buf, gsize nbytes, goffset ofs, GError **err)
+{
+    gsize ndone = 0;
+    gssize n;
+
+    /* Like _io_fd_read(), but at an explicit offset. */
+
+    while (ndone < nbytes) {
+	n = pread (fd, buf + ndone, nbytes - ndone, ofs + ndone);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    IO_ERRNO_ERR (err, errno, "Failed to read stream");
+	    return -1;
+	}
+
+	if (n == 0)
+	    break;
+
+	ndone += n;
+    }
+
+    return ndone;
+}
+
+
 static gboolean
-_io_read (IOStream *io, GError **err)
+_io_fd_pwrite (int fd, gconstpointer buf, gsize nbytes, goffset ofs,
+	       GError **err)
 {
+    gsize ndone = 0;
+    gssize n;
+
+    while (ndone < nbytes) {
+	n = pwrite (fd, buf + ndone, nbytes - ndone, ofs + ndone);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    IO_ERRNO_ERR (err, errno, "Failed to write stream");
+	    return TRUE;
+	}
+
+	ndone += n;
+    }
+
+    return FALSE;
+}
+
+
+static gpointer
+_io_readahead_thread (gpointer data)
+{
+    IOStream *io = data;
+    IOReadahead *ra = io->s.read.ra;
     gssize nread;
+    guint slot;
+    GError *suberr = NULL;
+
+    g_mutex_lock (&ra->lock);
+
+    while (!ra->quit) {
+	if (ra->nfilled + (ra->held ? 1 : 0) >= ra->nslots) {
+	    g_cond_wait (&ra->cond, &ra->lock);
+	    continue;
+	}
+
+	/* The consumer never touches a slot that isn't filled or held,
+	 * so we can read into this one without the lock. */
+
+	slot = (ra->head + ra->nfilled) % ra->nslots;
+	g_mutex_unlock (&ra->lock);
+	nread = _io_fd_read (io->fd, ra->bufs[slot], io->bufsz, &suberr);
+	g_mutex_lock (&ra->lock);
+
+	if (nread < 0) {
+	    ra->err = suberr;
+	    ra->done = TRUE;
+	} else {
+	    ra->nread[slot] = nread;
+	    ra->nfilled++;
+
+	    if (nread != io->bufsz)
+		ra->done = TRUE; /* EOF */
+	}
+
+	g_cond_broadcast (&ra->cond);
+
+	if (ra->done)
+	    break;
+    }
+
+    g_mutex_unlock (&ra->lock);
+    return NULL;
+}
+
+
+gboolean
+io_enable_readahead (IOStream *io, guint nblocks, gsize bufsz, GError **err)
+{
+    IOReadahead *ra;
+    gsize oldsz = io->bufsz;
+    guint i;
+
+    /* Only valid on a buffered read stream that hasn't yet been read
+     * from, since the thread takes over the file position. */
 
     g_assert (io->mode == IO_MODE_READ);
+    g_assert (!io->s.read.mapped);
+    g_assert (io->s.read.ra == NULL);
+    g_assert (!io->s.read.eof && io->s.read.curpos == io->bufsz);
+
+    if (nblocks < 2)
+	nblocks = 2;
+
+    if (bufsz != 0 && bufsz != io->bufsz) {
+	/* Changing the block size changes the alignment too. */
+	goffset ofs = io->s.read.bufofs + io->bufsz + io->s.read.startpos;
+
+	g_assert ((bufsz & 0xFF) == 0);
+	g_assert (!io->direct || bufsz % IO_DIRECT_ALIGN == 0);
+	io->bufsz = bufsz;
+	io->s.read.startpos = ofs % bufsz;
+	io->s.read.bufofs = ofs - io->s.read.startpos - bufsz;
+    }
 
-    nread = _io_fd_read (io->fd, io->s.read.buf, io->bufsz, err);
+    /* The thread reads whole blocks, so if we're starting partway into
+     * one, back up; _io_read() will skip the part we don't want. */
 
-    if (nread < 0)
+    if (io->s.read.startpos != 0 &&
+	lseek (io->fd, io->s.read.bufofs + io->bufsz, SEEK_SET) < 0) {
+	IO_ERRNO_ERR (err, errno, "Failed to seek stream");
+	/* Keep io_free() happy. */
+	io->bufsz = oldsz;
 	return TRUE;
+    }
 
-    if (nread != io->bufsz) {
-	/* EOF, since we couldn't get as much data as we wanted */
+    ra = g_new0 (IOReadahead, 1);
+    g_mutex_init (&ra->lock);
+    g_cond_init (&ra->cond);
+    ra->nslots = nblocks;
+    ra->bufs = g_new (gchar *, nblocks);
+    ra->nread = g_new0 (gsize, nblocks);
+
+    for (i = 0; i < nblocks; i++)
+	ra->bufs[i] = io_buf_alloc (io->bufsz);
+
+    /* The slots replace the stream buffer. */
+
+    io_buf_free (io->s.read.buf, oldsz);
+    io->s.read.buf = NULL;
+    io->s.read.curpos = io->bufsz;
+    io->s.read.ra = ra;
+
+    ra->thread = g_thread_try_new ("viskit-readahead", _io_readahead_thread,
+				   io, err);
+
+    if (ra->thread == NULL) {
+	/* Leaves the stream usable, after a fashion, so that io_free
+	 * works. */
 	io->s.read.eof = TRUE;
-	io->s.read.endpos = nread;
+	io->s.read.curpos = 0;
+	io->s.read.endpos = 0;
+	return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+static void
+_io_readahead_stop (IOReadahead *ra)
+{
+    if (ra->thread == NULL)
+	return;
+
+    g_mutex_lock (&ra->lock);
+    ra->quit = TRUE;
+    g_cond_broadcast (&ra->cond);
+    g_mutex_unlock (&ra->lock);
+    g_thread_join (ra->thread);
+    ra->thread = NULL;
+}
+
+
+static gboolean
+_io_readahead_restart (IOStream *io, goffset ofs, GError **err)
+{
+    IOReadahead *ra = io->s.read.ra;
+
+    /* Throw away everything we've read ahead and start again from
+     * @ofs. */
+
+    _io_readahead_stop (ra);
+
+    ra->head = 0;
+    ra->nfilled = 0;
+    ra->held = FALSE;
+    ra->done = FALSE;
+    ra->quit = FALSE;
+
+    if (ra->err != NULL) {
+	g_error_free (ra->err);
+	ra->err = NULL;
+    }
+
+    if (lseek (io->fd, ofs, SEEK_SET) < 0) {
+	IO_ERRNO_ERR (err, errno, "Failed to seek stream");
+	return TRUE;
+    }
+
+    ra->thread = g_thread_try_new ("viskit-readahead", _io_readahead_thread,
+				   io, err);
+    return ra->thread == NULL;
+}
+
+
+static void
+_io_readahead_free (IOStream *io)
+{
+    IOReadahead *ra = io->s.read.ra;
+    guint i;
+
+    _io_readahead_stop (ra);
+
+    for (i = 0; i < ra->nslots; i++)
+	io_buf_free (ra->bufs[i], io->bufsz);
+
+    if (ra->err != NULL)
+	g_error_free (ra->err);
+
+    g_free (ra->bufs);
+    g_free (ra->nread);
+    g_mutex_clear (&ra->lock);
+    g_cond_clear (&ra->cond);
+    g_free (ra);
+    io->s.read.ra = NULL;
+    io->s.read.buf = NULL;
+}
+
+
+static gssize
+_io_readahead_next (IOStream *io, GError **err)
+{
+    IOReadahead *ra = io->s.read.ra;
+    gssize nread;
+
+    g_mutex_lock (&ra->lock);
+
+    if (ra->held) {
+	/* Give back the block we were working on. */
+	ra->held = FALSE;
+	g_cond_broadcast (&ra->cond);
+    }
+
+    while (ra->nfilled == 0 && !ra->done)
+	g_cond_wait (&ra->cond, &ra->lock);
+
+    if (ra->nfilled == 0) {
+	/* The thread stopped without giving us anything, so it must
+	 * have hit an error. Keep reporting it. */
+	if (ra->err != NULL)
+	    g_propagate_error (err, g_error_copy (ra->err));
+	nread = ra->err != NULL ? -1 : 0;
+    } else {
+	io->s.read.buf = ra->bufs[ra->head];
+	nread = ra->nread[ra->head];
+	ra->head = (ra->head + 1) % ra->nslots;
+	ra->nfilled--;
+	ra->held = TRUE;
+    }
+
+    g_mutex_unlock (&ra->lock);
+    return nread;
+}
+
+/* Write-behind: the mirror image of read-ahead. Full blocks are
+ * queued for a helper thread to write while the writer carries on
+ * filling the next slot, so writes only wait for the disk once every
+ * slot is queued. If the thread fails, it stops, and the error is
+ * reported by every subsequent write call and by io_close_and_free(). */
+
+static gpointer
+_io_writebehind_thread (gpointer data)
+{
+    IOStream *io = data;
+    IOWriteBehind *wb = io->s.write.wb;
+    gboolean failed;
+    guint slot;
+    GError *suberr = NULL;
+
+    g_mutex_lock (&wb->lock);
+
+    while (!wb->quit) {
+	if (wb->nqueued == 0) {
+	    g_cond_wait (&wb->cond, &wb->lock);
+	    continue;
+	}
+
+	/* The writer never touches a queued slot, so we can write this
+	 * one without the lock. */
+
+	slot = wb->head;
+	g_mutex_unlock (&wb->lock);
+	failed = _io_write_span (io, wb->bufs[slot], wb->offsets[slot],
+				 wb->from[slot], wb->to[slot], &suberr);
+	g_mutex_lock (&wb->lock);
+
+	if (failed) {
+	    wb->err = suberr;
+	    g_atomic_int_set (&wb->failed, 1);
+	    g_cond_broadcast (&wb->cond);
+	    break;
+	}
+
+	wb->head = (wb->head + 1) % wb->nslots;
+	wb->nqueued--;
+	g_cond_broadcast (&wb->cond);
+    }
+
+    g_mutex_unlock (&wb->lock);
+    return NULL;
+}
+
+
+gboolean
+io_enable_writebehind (IOStream *io, guint nblocks, GError **err)
+{
+    IOWriteBehind *wb;
+    gchar *oldbuf = io->s.write.buf;
+    guint i;
+
+    /* Only valid on a write stream using the plain write() engine;
+     * io_uring already keeps writes in flight its own way. Enable
+     * O_DIRECT first, if at all. */
+
+    g_assert (io->mode == IO_MODE_WRITE);
+    g_assert (io->uring == NULL && io->s.write.wb == NULL);
+
+    if (nblocks < 2)
+	nblocks = 2;
+
+    wb = g_new0 (IOWriteBehind, 1);
+    g_mutex_init (&wb->lock);
+    g_cond_init (&wb->cond);
+    wb->nslots = nblocks;
+    wb->bufs = g_new (gchar *, nblocks);
+    wb->offsets = g_new0 (goffset, nblocks);
+    wb->from = g_new0 (gsize, nblocks);
+    wb->to = g_new0 (gsize, nblocks);
+
+    for (i = 0; i < nblocks; i++)
+	wb->bufs[i] = io_buf_alloc (io->bufsz);
+
+    /* Carry over anything already buffered. */
+
+    memcpy (wb->bufs[0], oldbuf, io->s.write.curpos);
+    io->s.write.wb = wb;
+    io->s.write.buf = wb->bufs[0];
+
+    wb->thread = g_thread_try_new ("viskit-writebehind", _io_writebehind_thread,
+				   io, err);
+
+    if (wb->thread == NULL) {
+	/* Go back to the way things were. */
+	_io_writebehind_free (io);
+	io->s.write.buf = oldbuf;
+	return TRUE;
+    }
+
+    io_buf_free (oldbuf, io->bufsz);
+    return FALSE;
+}
+
+
+static gboolean
+_io_writebehind_check (IOStream *io, GError **err)
+{
+    IOWriteBehind *wb;
+
+    /* Report a failure of the thread, if there's been one. */
+
+    if (io->mode != IO_MODE_WRITE || (wb = io->s.write.wb) == NULL ||
+	!g_atomic_int_get (&wb->failed))
+	return FALSE;
+
+    g_propagate_error (err, g_error_copy (wb->err));
+    return TRUE;
+}
+
+
+static gboolean
+_io_writebehind_queue (IOStream *io, gsize to, GError **err)
+{
+    IOWriteBehind *wb = io->s.write.wb;
+    guint slot;
+
+    /* Queue buf[startpos..@to) and switch buf to the next slot,
+     * waiting for it to come free if need be. The caller takes care of
+     * the positions. */
+
+    g_mutex_lock (&wb->lock);
+
+    slot = (wb->head + wb->nqueued) % wb->nslots;
+    wb->offsets[slot] = io->s.write.bufofs;
+    wb->from[slot] = io->s.write.startpos;
+    wb->to[slot] = to;
+    wb->nqueued++;
+    g_cond_broadcast (&wb->cond);
+
+    while (wb->nqueued == wb->nslots && wb->err == NULL)
+	g_cond_wait (&wb->cond, &wb->lock);
+
+    if (wb->err != NULL) {
+	g_propagate_error (err, g_error_copy (wb->err));
+	g_mutex_unlock (&wb->lock);
+	return TRUE;
+    }
+
+    io->s.write.buf = wb->bufs[(wb->head + wb->nqueued) % wb->nslots];
+    g_mutex_unlock (&wb->lock);
+    return FALSE;
+}
+
+
+static gboolean
+_io_writebehind_drain (IOStream *io, GError **err)
+{
+    IOWriteBehind *wb = io->s.write.wb;
+    gboolean retval = FALSE;
+
+    /* Get everything buffered into the file. We stay in the same
+     * block, now with nothing left to write before the cursor. */
+
+    if (io->s.write.curpos > io->s.write.startpos) {
+	if (_io_writebehind_queue (io, io->s.write.curpos, err))
+	    return TRUE;
+	io->s.write.startpos = io->s.write.curpos;
+    }
+
+    g_mutex_lock (&wb->lock);
+
+    while (wb->nqueued > 0 && wb->err == NULL)
+	g_cond_wait (&wb->cond, &wb->lock);
+
+    if (wb->err != NULL) {
+	g_propagate_error (err, g_error_copy (wb->err));
+	retval = TRUE;
+    }
+
+    g_mutex_unlock (&wb->lock);
+    return retval;
+}
+
+
+static void
+_io_writebehind_free (IOStream *io)
+{
+    IOWriteBehind *wb = io->s.write.wb;
+    guint i;
+
+    /* Anything still queued is abandoned. */
+
+    if (wb->thread != NULL) {
+	g_mutex_lock (&wb->lock);
+	wb->quit = TRUE;
+	g_cond_broadcast (&wb->cond);
+	g_mutex_unlock (&wb->lock);
+	g_thread_join (wb->thread);
+    }
+
+    for (i = 0; i < wb->nslots; i++)
+	io_buf_free (wb->bufs[i], io->bufsz);
+
+    if (wb->err != NULL)
+	g_error_free (wb->err);
+
+    g_free (wb->bufs);
+    g_free (wb->offsets);
+    g_free (wb->from);
+    g_free (wb->to);
+    g_mutex_clear (&wb->lock);
+    g_cond_clear (&wb->cond);
+    g_free (wb);
+    io->s.write.wb = NULL;
+    io->s.write.buf = NULL;
+}
+
+/* The io_uring engine. Like read-ahead, it works on a ring of
+ * block-sized slots, but instead of a helper thread it keeps up to
+ * one request per slot outstanding in the kernel at explicit file
+ * offsets. Readers are handed slots in file order as they complete;
+ * writers fill a slot, submit it, and move on to the next one,
+ * waiting only if every slot is still in flight. We talk to the
+ * kernel directly rather than depending on liburing. */
+
+#ifdef IO_HAVE_URING
+
+typedef enum _IOUringSlotState {
+    IOU_FREE = 0, /* idle; for readers, consumed */
+    IOU_BUSY = 1, /* request in flight */
+    IOU_DONE = 2, /* read complete and awaiting consumption */
+} IOUringSlotState;
+
+struct _IOUring {
+    int ringfd;
+    guint nslots;
+
+    guint *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    guint *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    gpointer sq_ring, cq_ring;
+    gsize sq_ring_sz, cq_ring_sz, sqes_sz;
+    guint nsubmit; /* queued but not yet submitted */
+    guint ninflight; /* submitted but not yet completed */
+
+    gchar **bufs;
+    struct iovec *iovs;
+    goffset *offsets; /* file offset of each slot's block */
+    gsize *ndone; /* bytes transferred so far for each slot */
+    gsize *nwant; /* bytes to transfer for each slot */
+    guint8 *state;
+    goffset fileofs; /* offset of the next block to issue */
+    guint head; /* readers: next slot to consume; writers: slot being filled */
+    gboolean held; /* readers: is the consumer holding the slot before head? */
+    gboolean eof; /* readers: has a read come back empty? */
+    int error; /* first errno reported by a completion */
+};
+
+
+static int
+_io_uring_enter (IOUring *ur, guint to_submit, guint min_complete)
+{
+    int ret;
+
+    do
+	ret = syscall (__NR_io_uring_enter, ur->ringfd, to_submit, min_complete,
+		       min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+
+static void
+_io_uring_queue (IOStream *io, guint slot)
+{
+    IOUring *ur = io->uring;
+    guint tail = *ur->sq_tail, idx = tail & *ur->sq_mask;
+    struct io_uring_sqe *sqe = &ur->sqes[idx];
+
+    ur->iovs[slot].iov_base = ur->bufs[slot] + ur->ndone[slot];
+    ur->iovs[slot].iov_len = ur->nwant[slot] - ur->ndone[slot];
+
+    memset (sqe, 0, sizeof (*sqe));
+    sqe->opcode = (io->mode == IO_MODE_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->fd = io->fd;
+    sqe->addr = (guint64) (gsize) &ur->iovs[slot];
+    sqe->len = 1;
+    sqe->off = ur->offsets[slot] + ur->ndone[slot];
+    sqe->user_data = slot;
+
+    ur->sq_array[idx] = idx;
+    __atomic_store_n (ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ur->state[slot] = IOU_BUSY;
+    ur->nsubmit++;
+}
+
+
+/* Submit anything queued and process completions, waiting for at
+ * least one if @wait is set and anything is in flight. Completions
+ * that transferred less than requested are resubmitted for the
+ * remainder, except for reads that hit EOF. */
+
+static gboolean
+_io_uring_reap (IOStream *io, gboolean wait, GError **err)
+{
+    IOUring *ur = io->uring;
+    guint head;
+    int ret;
+
+    ret = _io_uring_enter (ur, ur->nsubmit,
+			   (wait && ur->ninflight + ur->nsubmit > 0) ? 1 : 0);
+
+    if (ret < 0) {
+	IO_ERRNO_ERR (err, errno, "Failed to submit stream I/O");
+	return TRUE;
+    }
+
+    ur->ninflight += ret;
+    ur->nsubmit -= ret;
+    head = *ur->cq_head;
+
+    while (head != __atomic_load_n (ur->cq_tail, __ATOMIC_ACQUIRE)) {
+	struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+	guint slot = cqe->user_data;
+	int res = cqe->res;
+
+	head++;
+	ur->ninflight--;
+
+	if (res == -EINTR || res == -EAGAIN) {
+	    _io_uring_queue (io, slot);
+	    continue;
+	}
+
+	if (res < 0) {
+	    if (ur->error == 0)
+		ur->error = -res;
+	    ur->state[slot] = (io->mode == IO_MODE_READ) ? IOU_DONE : IOU_FREE;
+	    continue;
+	}
+
+	ur->ndone[slot] += res;
+
+	if (ur->ndone[slot] < ur->nwant[slot] && (res > 0 || io->mode == IO_MODE_WRITE)) {
+	    _io_uring_queue (io, slot);
+	    continue;
+	}
+
+	if (io->mode == IO_MODE_READ) {
+	    if (ur->ndone[slot] < ur->nwant[slot])
+		ur->eof = TRUE;
+	    ur->state[slot] = IOU_DONE;
+	} else
+	    ur->state[slot] = IOU_FREE;
+    }
+
+    __atomic_store_n (ur->cq_head, head, __ATOMIC_RELEASE);
+    return FALSE;
+}
+
+
+static void
+_io_uring_issue_block (IOStream *io, guint slot)
+{
+    IOUring *ur = io->uring;
+
+    ur->offsets[slot] = ur->fileofs;
+    ur->ndone[slot] = 0;
+    ur->nwant[slot] = io->bufsz;
+    ur->fileofs += io->bufsz;
+    _io_uring_queue (io, slot);
+}
+
+
+static gssize
+_io_uring_read_next (IOStream *io, GError **err)
+{
+    IOUring *ur = io->uring;
+    guint prev;
+
+    if (ur->held) {
+	/* Reuse the block we were working on to read further ahead. */
+	prev = (ur->head + ur->nslots - 1) % ur->nslots;
+	ur->held = FALSE;
+	ur->state[prev] = IOU_FREE;
+
+	if (!ur->eof)
+	    _io_uring_issue_block (io, prev);
+    }
+
+    while (ur->state[ur->head] != IOU_DONE) {
+	if (_io_uring_reap (io, TRUE, err))
+	    return -1;
+    }
+
+    if (ur->error != 0) {
+	IO_ERRNO_ERR (err, ur->error, "Failed to read stream");
+	return -1;
+    }
+
+    io->s.read.buf = ur->bufs[ur->head];
+    ur->head = (ur->head + 1) % ur->nslots;
+    ur->held = TRUE;
+    return ur->ndone[(ur->head + ur->nslots - 1) % ur->nslots];
+}
+
+
+static gboolean
+_io_uring_write_block (IOStream *io, GError **err)
+{
+    IOUring *ur = io->uring;
+    guint slot = ur->head;
+
+    if (io->direct && !IO_DIRECT_ALIGNED (io->s.write.bufofs + io->s.write.startpos,
+					  io->s.write.curpos - io->s.write.startpos)) {
+	/* A partial block at the start or end of the file, which
+	 * O_DIRECT can't handle. Let everything else land, then write it
+	 * synchronously, reusing the slot. */
+	while (ur->ninflight + ur->nsubmit > 0) {
+	    if (_io_uring_reap (io, TRUE, err))
+		return TRUE;
+	}
+
+	if (_io_write_span (io, io->s.write.buf, io->s.write.bufofs,
+			    io->s.write.startpos, io->s.write.curpos, err))
+	    return TRUE;
+
+	io->s.write.startpos = 0;
+	io->s.write.curpos = 0;
+	return FALSE;
+    }
+
+    /* Send off the slot we've been filling and move on to the next,
+     * waiting for it to come free if need be. */
+
+    ur->offsets[slot] = io->s.write.bufofs;
+    ur->ndone[slot] = io->s.write.startpos;
+    ur->nwant[slot] = io->s.write.curpos;
+    _io_uring_queue (io, slot);
+
+    io->s.write.startpos = 0;
+    ur->head = (ur->head + 1) % ur->nslots;
+
+    do {
+	if (_io_uring_reap (io, ur->state[ur->head] != IOU_FREE, err))
+	    return TRUE;
+    } while (ur->state[ur->head] != IOU_FREE);
+
+    io->s.write.buf = ur->bufs[ur->head];
+    io->s.write.curpos = 0;
+
+    if (ur->error != 0) {
+	IO_ERRNO_ERR (err, ur->error, "Failed to write stream");
+	return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+static gboolean
+_io_uring_restart (IOStream *io, goffset ofs, GError **err)
+{
+    IOUring *ur = io->uring;
+    guint i;
+
+    /* Let everything in flight land, then start reading again from
+     * @ofs. */
+
+    while (ur->ninflight + ur->nsubmit > 0) {
+	if (_io_uring_reap (io, TRUE, err))
+	    return TRUE;
+    }
+
+    ur->head = 0;
+    ur->held = FALSE;
+    ur->eof = FALSE;
+    ur->error = 0;
+    ur->fileofs = ofs;
+
+    for (i = 0; i < ur->nslots; i++)
+	_io_uring_issue_block (io, i);
+
+    return _io_uring_reap (io, FALSE, err);
+}
+
+
+static gboolean
+_io_uring_flush (IOStream *io, GError **err)
+{
+    IOUring *ur = io->uring;
+
+    if (io->s.write.curpos > io->s.write.startpos) {
+	if (_io_uring_write_block (io, err))
+	    return TRUE;
+    }
+
+    while (ur->ninflight + ur->nsubmit > 0) {
+	if (_io_uring_reap (io, TRUE, err))
+	    return TRUE;
+    }
+
+    if (ur->error != 0) {
+	IO_ERRNO_ERR (err, ur->error, "Failed to write stream");
+	return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+static void
+_io_uring_free (IOStream *io)
+{
+    IOUring *ur = io->uring;
+    guint i;
+
+    /* The kernel may still be using our buffers. */
+
+    while (ur->ninflight + ur->nsubmit > 0) {
+	if (_io_uring_reap (io, TRUE, NULL))
+	    break;
+    }
+
+    if (ur->sqes != NULL)
+	munmap (ur->sqes, ur->sqes_sz);
+    if (ur->cq_ring != NULL && ur->cq_ring != ur->sq_ring)
+	munmap (ur->cq_ring, ur->cq_ring_sz);
+    if (ur->sq_ring != NULL)
+	munmap (ur->sq_ring, ur->sq_ring_sz);
+    if (ur->ringfd >= 0)
+	close (ur->ringfd);
+
+    for (i = 0; i < ur->nslots; i++)
+	io_buf_free (ur->bufs[i], io->bufsz);
+
+    g_free (ur->bufs);
+    g_free (ur->iovs);
+    g_free (ur->offsets);
+    g_free (ur->ndone);
+    g_free (ur->nwant);
+    g_free (ur->state);
+    g_free (ur);
+    io->uring = NULL;
+
+    if (io->mode == IO_MODE_READ)
+	io->s.read.buf = NULL;
+    else
+	io->s.write.buf = NULL;
+}
+
+
+static IOUring *
+_io_uring_setup (guint nslots)
+{
+    IOUring *ur;
+    struct io_uring_params p;
+
+    memset (&p, 0, sizeof (p));
+    ur = g_new0 (IOUring, 1);
+    ur->ringfd = syscall (__NR_io_uring_setup, nslots, &p);
+
+    if (ur->ringfd < 0)
+	goto fail;
+
+    ur->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof (guint);
+    ur->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    ur->sqes_sz = p.sq_entries * sizeof (struct io_uring_sqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	ur->sq_ring_sz = ur->cq_ring_sz = MAX (ur->sq_ring_sz, ur->cq_ring_sz);
+
+    ur->sq_ring = mmap (NULL, ur->sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->ringfd, IORING_OFF_SQ_RING);
+    if (ur->sq_ring == MAP_FAILED) {
+	ur->sq_ring = NULL;
+	goto fail;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	ur->cq_ring = ur->sq_ring;
+    else {
+	ur->cq_ring = mmap (NULL, ur->cq_ring_sz, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ur->ringfd, IORING_OFF_CQ_RING);
+	if (ur->cq_ring == MAP_FAILED) {
+	    ur->cq_ring = NULL;
+	    goto fail;
+	}
+    }
+
+    ur->sqes = mmap (NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_POPULATE, ur->ringfd, IORING_OFF_SQES);
+    if (ur->sqes == MAP_FAILED) {
+	ur->sqes = NULL;
+	goto fail;
+    }
+
+    ur->sq_head = ur->sq_ring + p.sq_off.head;
+    ur->sq_tail = ur->sq_ring + p.sq_off.tail;
+    ur->sq_mask = ur->sq_ring + p.sq_off.ring_mask;
+    ur->sq_array = ur->sq_ring + p.sq_off.array;
+    ur->cq_head = ur->cq_ring + p.cq_off.head;
+    ur->cq_tail = ur->cq_ring + p.cq_off.tail;
+    ur->cq_mask = ur->cq_ring + p.cq_off.ring_mask;
+    ur->cqes = ur->cq_ring + p.cq_off.cqes;
+    return ur;
+
+fail:
+    if (ur->cq_ring != NULL && ur->cq_ring != ur->sq_ring)
+	munmap (ur->cq_ring, ur->cq_ring_sz);
+    if (ur->sq_ring != NULL)
+	munmap (ur->sq_ring, ur->sq_ring_sz);
+    if (ur->ringfd >= 0)
+	close (ur->ringfd);
+    g_free (ur);
+    return NULL;
+}
+
+
+gboolean
+io_enable_uring (IOStream *io, guint nblocks, GError **err)
+{
+    IOUring *ur;
+    goffset ofs;
+    int fl;
+    guint i;
+
+    /* Only valid on a fresh buffered stream. If the kernel won't give
+     * us a ring, we just stay with the read()/write() engine. */
+
+    g_assert (io->uring == NULL);
+    g_assert (io->mode != IO_MODE_READ_WRITE);
+
+    if (io->mode == IO_MODE_READ) {
+	g_assert (!io->s.read.mapped && io->s.read.ra == NULL);
+	g_assert (!io->s.read.eof && io->s.read.curpos == io->bufsz);
+    } else
+	g_assert (io->s.write.wb == NULL);
+
+    if (nblocks < 2)
+	nblocks = 2;
+
+    /* We issue I/O at explicit offsets, which we already track. Appends
+     * are a problem since the kernel ignores the offsets of positioned
+     * writes to O_APPEND descriptors, and would put our concurrent
+     * blocks in arbitrary order. The descriptor isn't ours to change,
+     * so such streams stay with write(). */
+
+    if ((fl = fcntl (io->fd, F_GETFL)) < 0) {
+	IO_ERRNO_ERR (err, errno, "Failed to query stream flags");
+	return TRUE;
+    }
+
+    if (io->mode == IO_MODE_WRITE && (fl & O_APPEND))
+	return FALSE;
+
+    if (lseek (io->fd, 0, SEEK_CUR) < 0)
+	/* Unseekable; positioned I/O won't work. */
+	return FALSE;
+
+    if (io->mode == IO_MODE_READ)
+	/* Reads start at the beginning of the block we're in; _io_read()
+	 * skips to where we actually are. */
+	ofs = io->s.read.bufofs + io->bufsz;
+    else
+	ofs = io->s.write.bufofs;
+
+    if ((ur = _io_uring_setup (nblocks)) == NULL)
+	return FALSE;
+
+    ur->nslots = nblocks;
+    ur->bufs = g_new (gchar *, nblocks);
+    ur->iovs = g_new0 (struct iovec, nblocks);
+    ur->offsets = g_new0 (goffset, nblocks);
+    ur->ndone = g_new0 (gsize, nblocks);
+    ur->nwant = g_new0 (gsize, nblocks);
+    ur->state = g_new0 (guint8, nblocks);
+    ur->fileofs = ofs;
+
+    for (i = 0; i < nblocks; i++)
+	ur->bufs[i] = io_buf_alloc (io->bufsz);
+
+    io->uring = ur;
+
+    if (io->mode == IO_MODE_READ) {
+	io_buf_free (io->s.read.buf, io->bufsz);
+	io->s.read.buf = NULL;
+
+	for (i = 0; i < nblocks; i++)
+	    _io_uring_issue_block (io, i);
+
+	if (_io_uring_reap (io, FALSE, err))
+	    return TRUE;
+    } else {
+	/* Carry over anything already buffered. */
+	memcpy (ur->bufs[0], io->s.write.buf, io->s.write.curpos);
+	io_buf_free (io->s.write.buf, io->bufsz);
+	io->s.write.buf = ur->bufs[0];
+    }
+
+    return FALSE;
+}
+
+#else /* !IO_HAVE_URING */
+
+static gssize
+_io_uring_read_next (IOStream *io, GError **err)
+{
+    g_assert_not_reached ();
+    return -1;
+}
+
+static gboolean
+_io_uring_write_block (IOStream *io, GError **err)
+{
+    g_assert_not_reached ();
+    return TRUE;
+}
+
+static gboolean
+_io_uring_restart (IOStream *io, goffset ofs, GError **err)
+{
+    g_assert_not_reached ();
+    return TRUE;
+}
+
+static gboolean
+_io_uring_flush (IOStream *io, GError **err)
+{
+    g_assert_not_reached ();
+    return TRUE;
+}
+
+static void
+_io_uring_free (IOStream *io)
+{
+    g_assert_not_reached ();
+}
+
+gboolean
+io_enable_uring (IOStream *io, guint nblocks, GError **err)
+{
+    /* Not available here; keep using read()/write(). */
+    return FALSE;
+}
+
+#endif /* IO_HAVE_URING */
+
+
+static gboolean
+_io_read (IOStream *io, GError **err)
+{
+    gssize nread;
+
+    g_assert (io->mode & IO_MODE_READ);
+
+    if (io->mode == IO_MODE_READ_WRITE) {
+	/* Read-write streams address the file purely by offset, and
+	 * always hold whole blocks. */
+	if (_io_rw_writeback (io, err))
+	    return TRUE;
+	nread = _io_fd_pread (io->fd, io->s.read.buf, io->bufsz,
+			      io->s.read.bufofs + io->bufsz, err);
+    } else if (io->s.read.ra != NULL)
+	nread = _io_readahead_next (io, err);
+    else if (io->uring != NULL)
+	nread = _io_uring_read_next (io, err);
+    else if (io->direct)
+	/* Direct reads must be whole blocks, so io_enable_direct() backed
+	 * up to the start of this one. */
+	nread = _io_fd_read (io->fd, io->s.read.buf, io->bufsz, err);
+    else {
+	/* If we started partway into a block, only read the rest of it. */
+	nread = _io_fd_read (io->fd, io->s.read.buf + io->s.read.startpos,
+			     io->bufsz - io->s.read.startpos, err);
+	if (nread >= 0)
+	    nread += io->s.read.startpos;
+    }
+
+    if (nread < 0)
+	return TRUE;
+
+    /* Every buffer but the one at EOF is full, so the file position
+     * has always just advanced by a whole block. */
+    io->s.read.bufofs += io->bufsz;
+    _io_drop_behind (io, io->s.read.bufofs);
+
+    if (nread != io->bufsz) {
+	/* EOF, since we couldn't get as much data as we wanted */
+	io->s.read.eof = TRUE;
+	io->s.read.endpos = nread;
+    }
+
+    io->s.read.curpos = io->s.read.startpos;
+    io->s.read.startpos = 0;
+
+    if (io->s.read.eof && io->s.read.curpos > io->s.read.endpos)
+	io->s.read.curpos = io->s.read.endpos;
+
+    return FALSE;
+}
+
+
+static gboolean
+_io_write (IOStream *io, GError **err)
+{
+    g_assert (io->mode == IO_MODE_WRITE);
+
+    if (io->uring != NULL) {
+	if (_io_uring_write_block (io, err))
+	    return TRUE;
+    } else if (io->s.write.wb != NULL) {
+	if (_io_writebehind_queue (io, io->bufsz, err))
+	    return TRUE;
+    } else {
+	if (_io_write_span (io, io->s.write.buf, io->s.write.bufofs,
+			    io->s.write.startpos, io->bufsz, err))
+	    return TRUE;
+    }
+
+    io->s.write.bufofs += io->bufsz;
+    io->s.write.startpos = 0;
+    io->s.write.curpos = 0;
+    _io_drop_behind (io, io->s.write.bufofs);
+    return FALSE;
+}
+
+
+static gboolean
+_io_write_span (IOStream *io, const gchar *buf, goffset bufofs, gsize from,
+		gsize to, GError **err)
+{
+    gboolean unaligned, retval;
+
+    /* Write buf[from..to) to the file, where it belongs at bufofs +
+     * from. On a direct stream, the partial blocks at the start and
+     * end of the file have to go through the page cache. */
+
+    unaligned = io->direct && !IO_DIRECT_ALIGNED (bufofs + from, to - from);
+
+    if (unaligned)
+	_io_direct_set (io, FALSE);
+
+    if (io->uring != NULL)
+	/* io_uring doesn't move the file position. */
+	retval = _io_fd_pwrite (io->fd, buf + from, to - from, bufofs + from, err);
+    else
+	retval = _io_fd_write (io->fd, buf + from, to - from, err);
+
+    if (unaligned)
+	_io_direct_set (io, TRUE);
+
+    return retval;
+}
+
+
+/* Read-write streams. The buffer holds one block of the file, which
+ * may be modified in place; the modified range is written back when
+ * the buffer moves on to another block or the stream is closed. */
+
+static void
+_io_rw_mark_dirty (IOStream *io, gsize lo, gsize hi)
+{
+    if (io->s.read.dirtylo >= io->s.read.dirtyhi) {
+	io->s.read.dirtylo = lo;
+	io->s.read.dirtyhi = hi;
+    } else {
+	io->s.read.dirtylo = MIN (io->s.read.dirtylo, lo);
+	io->s.read.dirtyhi = MAX (io->s.read.dirtyhi, hi);
+    }
+
+    /* Writing at EOF extends the file. */
+
+    if (io->s.read.eof && hi > io->s.read.endpos)
+	io->s.read.endpos = hi;
+}
+
+
+static gboolean
+_io_rw_writeback (IOStream *io, GError **err)
+{
+    if (io->s.read.dirtylo >= io->s.read.dirtyhi)
+	return FALSE;
+
+    if (_io_fd_pwrite (io->fd, io->s.read.buf + io->s.read.dirtylo,
+		       io->s.read.dirtyhi - io->s.read.dirtylo,
+		       io->s.read.bufofs + io->s.read.dirtylo, err))
+	return TRUE;
+
+    io->s.read.dirtylo = io->s.read.dirtyhi = 0;
+    return FALSE;
+}
+
+
+static gboolean
+_io_rw_write (IOStream *io, DSType type, gsize nvals, gconstpointer buf,
+	      GError **err)
+{
+    gconstpointer bufiter = buf;
+    guint8 tsize = ds_type_sizes[type];
+    gsize nbytes = nvals * tsize;
+
+    /* Overwrite the data at the cursor, extending the file if we run
+     * past its end. */
+
+    while (nbytes > 0) {
+	gsize nbytestowrite;
+
+	if (io->s.read.curpos == io->bufsz) {
+	    if (_io_read (io, err))
+		return TRUE;
+	}
+
+	nbytestowrite = MIN (nbytes, io->bufsz - io->s.read.curpos);
+
+	if (nbytestowrite % tsize != 0) {
+	    g_assert (0);
+	    return TRUE;
+	}
+
+	io_recode_data_copy (bufiter, io->s.read.buf + io->s.read.curpos,
+			     type, nbytestowrite / tsize);
+	_io_rw_mark_dirty (io, io->s.read.curpos,
+			   io->s.read.curpos + nbytestowrite);
+	io->s.read.curpos += nbytestowrite;
+
+	bufiter += nbytestowrite;
+	nbytes -= nbytestowrite;
     }
 
-    io->s.read.curpos = 0;
     return FALSE;
 }
 
 
-static gboolean
-_io_write (IOStream *io, GError **err)
+static void
+_io_reserve_scratch (IOStream *io, gsize nbytes)
 {
-    g_assert (io->mode == IO_MODE_WRITE);
+    /* The old contents aren't preserved. */
 
-    if (_io_fd_write (io->fd, io->s.write.buf, io->bufsz, err) < 0)
-	return TRUE;
+    if (io->s.read.scratchsz >= nbytes)
+	return;
 
-    io->s.write.curpos = 0;
-    return FALSE;
+    io_buf_free (io->s.read.scratch, io->s.read.scratchsz);
+    io->s.read.scratch = io_buf_alloc (nbytes);
+    io->s.read.scratchsz = nbytes;
 }
 
 
 gssize
 io_read_into_temp_buf (IOStream *io, gsize nbytes, gpointer *dest, GError **err)
 {
-    g_assert (io->mode == IO_MODE_READ);
-    /* disallow this situation for now. */
-    g_assert (nbytes <= io->bufsz);
+    g_assert (io->mode & IO_MODE_READ);
 
     if (dest != NULL)
 	*dest = NULL;
@@ -415,33 +1913,23 @@ io_read_into_temp_buf (IOStream *io, gsize nbytes, gpointer *dest, GError **err)
 
     /* We handled EOF, and the request isn't entirely buffered,
      * and we handled the exact-buffer-boundary case. We must
-     * be reading across the end of the current buffer. */
+     * be reading across the end of the current buffer, possibly
+     * across many blocks. Assemble the data in the scratch buffer,
+     * growing it if need be. For big requests, io_read_into_user_buf()
+     * reads whole blocks straight into it. */
 
     {
-	gsize nlow = io->bufsz - io->s.read.curpos;
-	gpointer buf2;
-	gsize nhi;
-	GError *suberr = NULL;
-
-	/* Copy in what we've already got in the current buffer. */
-
-	memcpy (io->s.read.scratch, io->s.read.buf + io->s.read.curpos, nlow);
+	gssize nread;
 
-	/* Try to get the rest. May hit EOF. */
+	_io_reserve_scratch (io, nbytes);
+	nread = io_read_into_user_buf (io, DST_I8, nbytes, io->s.read.scratch, err);
 
-	if (_io_read (io, err))
-	    return -1;
-
-	nhi = io_read_into_temp_buf (io, nbytes - nlow, &buf2, &suberr);
-
-	if (suberr != NULL) {
-	    g_propagate_error (err, suberr);
+	if (nread < 0)
 	    return -1;
-	}
 
-	memcpy (io->s.read.scratch + nlow, buf2, nhi);
-	*dest = io->s.read.scratch;
-	return nlow + nhi;
+	if (dest != NULL)
+	    *dest = io->s.read.scratch;
+	return nread;
     }
 }
 
@@ -451,7 +1939,7 @@ io_read_into_temp_buf_typed (IOStream *io, DSType type, gsize nvals, gpointer *d
 {
     gssize retval;
 
-    g_assert (io->mode == IO_MODE_READ);
+    g_assert (io->mode & IO_MODE_READ);
     g_assert (dest != NULL);
 
     retval = io_read_into_temp_buf (io, nvals * ds_type_sizes[type], dest, err);
@@ -459,8 +1947,27 @@ io_read_into_temp_buf_typed (IOStream *io, DSType type, gsize nvals, gpointer *d
     if (retval < 0)
 	return retval;
 
-    io_recode_data_inplace (*dest, type, nvals);
-    return retval / ds_type_sizes[type];
+    nvals = retval / ds_type_sizes[type];
+
+    if (ds_type_sizes[type] == 1 || G_BYTE_ORDER == G_BIG_ENDIAN)
+	return nvals;
+
+    /* Data assembled in the scratch buffer is ours to decode in place.
+     * Anything else is left raw: the stream buffer can be seeked back
+     * over, read again with io_read_at(), or written back, and a
+     * mapping can't be written at all. So it's decoded into the
+     * scratch buffer, which is no more copying than an in-place
+     * recode. */
+
+    if (*dest == io->s.read.scratch) {
+	io_recode_data_inplace (*dest, type, nvals);
+	return nvals;
+    }
+
+    _io_reserve_scratch (io, retval);
+    io_recode_data_copy (*dest, io->s.read.scratch, type, nvals);
+    *dest = io->s.read.scratch;
+    return nvals;
 }
 
 gssize
@@ -469,7 +1976,7 @@ io_read_into_user_buf (IOStream *io, DSType type, gsize nvals, gpointer buf,
 {
     gsize nbytes, ninbuf;
 
-    g_assert (io->mode == IO_MODE_READ);
+    g_assert (io->mode & IO_MODE_READ);
     g_assert (buf != NULL);
 
     nbytes = nvals * ds_type_sizes[type];
@@ -509,44 +2016,55 @@ io_read_into_user_buf (IOStream *io, DSType type, gsize nvals, gpointer buf,
 	gsize ntoread = nbytes - ninbuf;
 	gsize nblocks = ntoread / io->bufsz; /* truncating div. */
 
-	if (nblocks > 0) {
-	    /* Read all but the last block directly into the user's buffer. */
+	if (nblocks > 0 && io->mode == IO_MODE_READ && io->s.read.ra == NULL &&
+	    io->uring == NULL && io->s.read.startpos == 0 && !io->direct) {
+	    /* Read all but the last block directly into the user's buffer.
+	     * (When reading ahead, the data are already on their way into
+	     * our own blocks, so we just copy them out below. Read-write
+	     * streams always go through their buffer, as do direct ones,
+	     * since the user's buffer probably isn't aligned.) */
 	    gssize nread;
+	    gsize nblockbytes = nblocks * io->bufsz;
 
-	    ntoread = nblocks * io->bufsz;
-	    nread = _io_fd_read (io->fd, buf + ninbuf, ntoread, err);
+	    nread = _io_fd_read (io->fd, buf + ninbuf, nblockbytes, err);
 
 	    if (nread < 0)
 		return -1;
 
-	    if (nread < ntoread) {
-		/* EOF, short read */
+	    if (nread < nblockbytes) {
+		/* EOF, short read. Position an empty buffer there. */
+		io->s.read.bufofs += io->bufsz + nread;
 		io->s.read.curpos = 0;
 		io->s.read.endpos = 0;
 		io->s.read.eof = TRUE;
-	    }
+	    } else
+		/* The (consumed) buffer moves along with us. */
+		io->s.read.bufofs += nread;
 
 	    ntoread -= nread;
 	    ninbuf += nread;
 	}
 
-	if (ntoread > 0 && !io->s.read.eof) {
+	while (ntoread > 0 && !io->s.read.eof) {
 	    /* Not EOF and we have a little bit more to read. (Specifically, we
-	     * have less than bufsz.) This batch gets read into the IO stream
-	     * buffer to preserve its alignment properties.*/
+	     * have less than bufsz, unless we skipped the direct read above.)
+	     * This batch gets read into the IO stream buffer to preserve its
+	     * alignment properties.*/
 	    gsize navail;
 
 	    if (_io_read (io, err))
 		return -1;
 
 	    if (io->s.read.eof)
-		navail = MIN (ntoread, io->s.read.endpos);
+		navail = io->s.read.endpos - io->s.read.curpos;
 	    else
-		navail = ntoread;
+		navail = io->bufsz - io->s.read.curpos;
 
-	    memcpy (buf + ninbuf, io->s.read.buf, navail);
+	    navail = MIN (ntoread, navail);
+	    memcpy (buf + ninbuf, io->s.read.buf + io->s.read.curpos, navail);
 	    ninbuf += navail;
-	    io->s.read.curpos = navail;
+	    ntoread -= navail;
+	    io->s.read.curpos += navail;
 	}
     }
 
@@ -563,12 +2081,75 @@ io_read_into_user_buf (IOStream *io, DSType type, gsize nvals, gpointer buf,
 }
 
 
+gssize
+io_read_into_user_buf_as (IOStream *io, DSType type, gsize nvals,
+			  DSType desttype, gpointer buf, GError **err)
+{
+    gsize tsize, dsize, ndone = 0;
+
+    /* Like io_read_into_user_buf(), but the values are converted to
+     * @desttype as they're decoded, straight out of our buffer, with
+     * the same semantics as ds_type_upconvert(). */
+
+    g_assert (io->mode & IO_MODE_READ);
+    g_assert (buf != NULL);
+    g_assert (io_recode_convertible (type, desttype));
+
+    if (type == desttype)
+	return io_read_into_user_buf (io, type, nvals, buf, err);
+
+    tsize = ds_type_sizes[type];
+    dsize = ds_type_sizes[desttype];
+
+    while (ndone < nvals) {
+	gsize navail, n;
+
+	if (!io->s.read.eof && io->s.read.curpos == io->bufsz) {
+	    if (_io_read (io, err))
+		return -1;
+	    continue;
+	}
+
+	if (io->s.read.eof)
+	    navail = io->s.read.endpos - io->s.read.curpos;
+	else
+	    navail = io->bufsz - io->s.read.curpos;
+
+	if (navail == 0)
+	    break; /* EOF; short read. */
+
+	if (navail < tsize) {
+	    /* A value straddles the end of our buffer. Assemble it
+	     * separately. A value cut off by EOF is a truncated file,
+	     * which we consider to be an I/O error. */
+	    gchar tmp[8];
+
+	    if (io_read_into_user_buf (io, DST_I8, tsize, tmp, err) != tsize)
+		return -1;
+
+	    io_recode_data_convert (tmp, type, (gchar *) buf + ndone * dsize,
+				    desttype, 1);
+	    ndone++;
+	    continue;
+	}
+
+	n = MIN (nvals - ndone, navail / tsize);
+	io_recode_data_convert (io->s.read.buf + io->s.read.curpos, type,
+				(gchar *) buf + ndone * dsize, desttype, n);
+	io->s.read.curpos += n * tsize;
+	ndone += n;
+    }
+
+    return ndone;
+}
+
+
 gboolean
 io_nudge_align (IOStream *io, gsize align_size, GError **err)
 {
     gsize n;
 
-    if (io->mode == IO_MODE_READ) {
+    if (io->mode & IO_MODE_READ) {
 	if ((n = io->s.read.curpos % align_size) == 0)
 	    return FALSE;
 
@@ -582,6 +2163,18 @@ io_nudge_align (IOStream *io, gsize align_size, GError **err)
 		return FALSE;
 	    }
 
+	    if (io->mode == IO_MODE_READ_WRITE) {
+		/* We're extending the file, so pad with zeros as a
+		 * write stream would. As below, this stays within the
+		 * buffer. */
+		g_assert (io->s.read.curpos + n <= io->bufsz);
+		memset (io->s.read.buf + io->s.read.endpos, 0,
+			io->s.read.curpos + n - io->s.read.endpos);
+		_io_rw_mark_dirty (io, io->s.read.endpos, io->s.read.curpos + n);
+		io->s.read.curpos += n;
+		return FALSE;
+	    }
+
 	    /* Land us on EOF */
 	    io->s.read.curpos = io->s.read.endpos;
 	    return FALSE;
@@ -619,23 +2212,175 @@ io_nudge_align (IOStream *io, gsize align_size, GError **err)
 }
 
 
+goffset
+io_tell (IOStream *io)
+{
+    /* startpos is only nonzero on a read stream before its first
+     * block has been loaded, when the cursor is at the end of the
+     * (empty) buffer. */
+
+    if (io->mode & IO_MODE_READ)
+	return io->s.read.bufofs + io->s.read.curpos + io->s.read.startpos;
+    return io->s.write.bufofs + io->s.write.curpos;
+}
+
+
+gboolean
+io_seek (IOStream *io, goffset offset, GError **err)
+{
+    goffset blockofs;
+    gsize limit;
+
+    g_assert (io->mode & IO_MODE_READ);
+    g_assert (offset >= 0);
+
+    /* Seeking past EOF lands us on EOF. */
+
+    if (io->s.read.mapped) {
+	io->s.read.curpos = MIN (offset, io->s.read.endpos);
+	return FALSE;
+    }
+
+    /* If the target is resident (including the position just past
+     * the end of a full buffer), just move the cursor. */
+
+    limit = io->s.read.eof ? io->s.read.endpos : io->bufsz;
+
+    if (io->s.read.bufofs >= 0 && io->s.read.startpos == 0 &&
+	offset >= io->s.read.bufofs && offset - io->s.read.bufofs <= limit) {
+	io->s.read.curpos = offset - io->s.read.bufofs;
+	return FALSE;
+    }
+
+    if (io->s.read.eof && offset > io->s.read.bufofs + io->s.read.endpos &&
+	io->s.read.bufofs >= 0) {
+	io->s.read.curpos = io->s.read.endpos;
+	return FALSE;
+    }
+
+    /* Otherwise, load the block containing the target. Keeping the
+     * buffer block-aligned within the file preserves the invariants
+     * that io_nudge_align() depends on. */
+
+    blockofs = offset - offset % io->bufsz;
+
+    if (io->mode == IO_MODE_READ_WRITE) {
+	/* We load blocks by offset, so no need to seek. */
+	if (_io_rw_writeback (io, err))
+	    return TRUE;
+    } else if (io->s.read.ra != NULL) {
+	if (_io_readahead_restart (io, blockofs, err))
+	    return TRUE;
+    } else if (io->uring != NULL) {
+	if (_io_uring_restart (io, blockofs, err))
+	    return TRUE;
+    } else if (lseek (io->fd, blockofs, SEEK_SET) < 0) {
+	IO_ERRNO_ERR (err, errno, "Failed to seek stream");
+	return TRUE;
+    }
+
+    io->s.read.bufofs = blockofs - io->bufsz;
+    io->s.read.startpos = 0;
+    io->s.read.curpos = io->bufsz;
+    io->s.read.endpos = 0;
+    io->s.read.eof = FALSE;
+
+    if (_io_read (io, err))
+	return TRUE;
+
+    io->s.read.curpos = offset - blockofs;
+
+    if (io->s.read.eof && io->s.read.curpos > io->s.read.endpos)
+	io->s.read.curpos = io->s.read.endpos;
+
+    return FALSE;
+}
+
+
+gssize
+io_read_at (IOStream *io, goffset offset, gsize nbytes, gpointer buf,
+	    GError **err)
+{
+    gsize limit;
+
+    /* Like pread(): copy raw (undecoded) bytes without moving the
+     * stream cursor. */
+
+    g_assert (io->mode & IO_MODE_READ);
+    g_assert (offset >= 0);
+
+    limit = io->s.read.eof ? io->s.read.endpos : io->bufsz;
+
+    if (io->s.read.mapped) {
+	if (offset >= limit)
+	    return 0;
+	nbytes = MIN (nbytes, limit - offset);
+	memcpy (buf, io->s.read.buf + offset, nbytes);
+	return nbytes;
+    }
+
+    if (io->s.read.bufofs >= 0 && io->s.read.startpos == 0 &&
+	offset >= io->s.read.bufofs &&
+	offset - io->s.read.bufofs + nbytes <= limit) {
+	memcpy (buf, io->s.read.buf + (offset - io->s.read.bufofs), nbytes);
+	return nbytes;
+    }
+
+    /* The file has to be up to date for us to read it. */
+
+    if (io->mode == IO_MODE_READ_WRITE && _io_rw_writeback (io, err))
+	return -1;
+
+    if (io->direct && nbytes > 0) {
+	/* O_DIRECT only reads whole blocks, so read the ones covering
+	 * the request and copy out the part we want. We leave the fd in
+	 * O_DIRECT, since a read-ahead thread may be using it. */
+	goffset start = offset & ~(goffset) (IO_DIRECT_ALIGN - 1);
+	gsize skip = offset - start;
+	gsize len = (skip + nbytes + IO_DIRECT_ALIGN - 1) & ~(gsize) (IO_DIRECT_ALIGN - 1);
+	gchar *bounce = io_buf_alloc (len);
+	gssize nread;
+
+	if ((nread = _io_fd_pread (io->fd, bounce, len, start, err)) >= 0) {
+	    nread = ((gsize) nread > skip) ? MIN ((gsize) nread - skip, nbytes) : 0;
+	    memcpy (buf, bounce + skip, nread);
+	}
+
+	io_buf_free (bounce, len);
+	return nread;
+    }
+
+    return _io_fd_pread (io->fd, buf, nbytes, offset, err);
+}
+
+
 gboolean
 io_write_raw (IOStream *io, gsize nbytes, gconstpointer buf, GError **err)
 {
     gconstpointer bufiter = buf;
 
-    g_assert (io->mode == IO_MODE_WRITE);
+    g_assert (io->mode & IO_MODE_WRITE);
+
+    if (io->mode == IO_MODE_READ_WRITE)
+	return _io_rw_write (io, DST_I8, nbytes, buf, err);
+
+    if (_io_writebehind_check (io, err))
+	return TRUE;
 
     while (nbytes > 0) {
 	gsize ntowrite;
 
 	ntowrite = MIN (nbytes, io->bufsz - io->s.write.curpos);
 
-	if (io->s.write.curpos == 0 && ntowrite == io->bufsz) {
+	if (io->s.write.curpos == 0 && ntowrite == io->bufsz && io->uring == NULL &&
+	    io->s.write.wb == NULL && !io->direct) {
 	    /* We'd write an entire buffer of data. We can short-circuit
-	     * the copying of the data to the write buffer. */
+	     * the copying of the data to the write buffer. (Not with
+	     * io_uring or write-behind, which need the data to stick
+	     * around, nor with O_DIRECT, which needs them aligned.) */
 	    if (_io_fd_write (io->fd, bufiter, ntowrite, err))
 		return TRUE;
+	    io->s.write.bufofs += ntowrite;
 	} else {
 	    memcpy (io->s.write.buf + io->s.write.curpos, bufiter, ntowrite);
 	    io->s.write.curpos += ntowrite;
@@ -660,10 +2405,28 @@ io_write_typed (IOStream *io, DSType type, gsize nvals, gconstpointer buf,
 		GError **err)
 {
     gconstpointer bufiter = buf;
-    guint8 tsize = ds_type_sizes[type];
-    gsize nbytes = nvals * tsize;
+    guint8 tsize;
+    gsize nbytes;
 
-    g_assert (io->mode == IO_MODE_WRITE);
+    g_assert (io->mode & IO_MODE_WRITE);
+
+    /* Complex values are only 4-byte aligned, so one may straddle the
+     * end of the buffer. They recode as pairs of floats, so treat
+     * them that way. */
+
+    if (type == DST_C64) {
+	type = DST_F32;
+	nvals *= 2;
+    }
+
+    if (io->mode == IO_MODE_READ_WRITE)
+	return _io_rw_write (io, type, nvals, buf, err);
+
+    if (_io_writebehind_check (io, err))
+	return TRUE;
+
+    tsize = ds_type_sizes[type];
+    nbytes = nvals * tsize;
 
     while (nbytes > 0) {
 	gsize nbytestowrite, nvalstowrite;
@@ -699,42 +2462,339 @@ io_write_typed (IOStream *io, DSType type, gsize nvals, gconstpointer buf,
 }
 
 
+gboolean
+io_write_segments (IOStream *io, const IOSegment *segs, guint nsegs,
+		   GError **err)
+{
+    gsize pos;
+    guint i;
+
+    g_assert (io->mode & IO_MODE_WRITE);
+
+    /* Usually everything fits in the buffer, in which case we can lay
+     * it all down in one pass without the bookkeeping of the
+     * individual write calls. Buffers are block-aligned within the
+     * file, so aligning within the buffer is aligning within the
+     * file. */
+
+    if (_io_writebehind_check (io, err))
+	return TRUE;
+
+    if (io->mode == IO_MODE_WRITE) {
+	pos = io->s.write.curpos;
+
+	for (i = 0; i < nsegs; i++) {
+	    if (segs[i].align > 1)
+		pos = (pos + segs[i].align - 1) / segs[i].align * segs[i].align;
+	    pos += segs[i].nvals * ds_type_sizes[segs[i].type];
+	}
+
+	if (pos <= io->bufsz) {
+	    pos = io->s.write.curpos;
+
+	    for (i = 0; i < nsegs; i++) {
+		if (segs[i].align > 1 && pos % segs[i].align != 0) {
+		    gsize n = segs[i].align - pos % segs[i].align;
+
+		    memset (io->s.write.buf + pos, 0, n);
+		    pos += n;
+		}
+
+		io_recode_data_copy (segs[i].data, io->s.write.buf + pos,
+				     segs[i].type, segs[i].nvals);
+		pos += segs[i].nvals * ds_type_sizes[segs[i].type];
+	    }
+
+	    io->s.write.curpos = pos;
+
+	    if (pos == io->bufsz)
+		return _io_write (io, err);
+	    return FALSE;
+	}
+    }
+
+    /* Otherwise, go a piece at a time. */
+
+    for (i = 0; i < nsegs; i++) {
+	if (segs[i].align > 1 && io_nudge_align (io, segs[i].align, err))
+	    return TRUE;
+
+	if (io_write_typed (io, segs[i].type, segs[i].nvals, segs[i].data, err))
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+/* Whole-item copies. The kernel can copy between files without the
+ * data ever entering user space, sharing extents (reflinking) on
+ * filesystems that support it, so we try that first and only shuttle
+ * data through our own buffers when we have to. */
+
+#define IO_KCOPY_CHUNK (1 << 30)
+#define IO_SPLICE_CHUNK (1 << 16)
+
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#endif
+
+static gboolean
+_io_kcopy_unsupported (int errnum)
+{
+    /* Errors meaning "not between these two files", rather than that
+     * something actually went wrong. EBADF is what we get for O_APPEND
+     * output. */
+
+    return errnum == ENOSYS || errnum == EXDEV || errnum == EINVAL ||
+	errnum == EOPNOTSUPP || errnum == EBADF || errnum == ESPIPE;
+}
+
+
+static int
+_io_kernel_copy (int infd, goffset *inofs, goffset insize, int outfd,
+		 goffset *outofs)
+{
+    /* Copy from @infd at *@inofs to @outfd at *@outofs until EOF
+     * without bringing the data into user space. Returns 0 if
+     * everything was copied, -1 if the kernel can't do (the rest of)
+     * the job, or an errno value. The offsets are advanced past
+     * whatever was copied, so the caller can pick up from there. Some
+     * filesystems claim to have nothing to copy when they really mean
+     * that they can't, so we check against @insize. */
+
+#ifdef __NR_copy_file_range
+    for (;;) {
+	gssize n = syscall (__NR_copy_file_range, infd, inofs, outfd, outofs,
+			    (gsize) IO_KCOPY_CHUNK, 0);
+
+	if (n > 0)
+	    continue;
+	if (n == 0) {
+	    if (*inofs >= insize)
+		return 0;
+	    break;
+	}
+	if (errno == EINTR)
+	    continue;
+	if (!_io_kcopy_unsupported (errno))
+	    return errno;
+	break;
+    }
+#endif
+
+#ifdef __NR_splice
+    {
+	int pipefds[2], retval = -1;
+
+	if (pipe (pipefds))
+	    return -1;
+
+	for (;;) {
+	    gssize n, m;
+
+	    n = syscall (__NR_splice, infd, inofs, pipefds[1], NULL,
+			 (gsize) IO_SPLICE_CHUNK, SPLICE_F_MOVE);
+
+	    if (n < 0) {
+		if (errno == EINTR)
+		    continue;
+		if (!_io_kcopy_unsupported (errno))
+		    retval = errno;
+		break;
+	    }
+
+	    if (n == 0) {
+		if (*inofs >= insize)
+		    retval = 0;
+		break;
+	    }
+
+	    while (n > 0) {
+		m = syscall (__NR_splice, pipefds[0], NULL, outfd, outofs,
+			     (gsize) n, SPLICE_F_MOVE);
+
+		if (m < 0 && errno == EINTR)
+		    continue;
+		if (m < 0 && !_io_kcopy_unsupported (errno))
+		    retval = errno;
+		if (m <= 0)
+		    break;
+
+		n -= m;
+	    }
+
+	    if (n > 0) {
+		/* Whatever is left in the pipe gets thrown away; back
+		 * up so that it's copied again. If the output took
+		 * nothing without saying why, retval is still -1 and
+		 * the caller finishes the job by hand. */
+		*inofs -= n;
+		break;
+	    }
+	}
+
+	close (pipefds[0]);
+	close (pipefds[1]);
+	return retval;
+    }
+#else
+    return -1;
+#endif
+}
+
+
 gboolean
 io_pipe (IOStream *input, IOStream *output, GError **err)
 {
-    gsize neof;
+    goffset inofs, outofs;
+    struct stat statbuf;
+    gboolean failed = FALSE;
+    gsize limit;
+    gssize n;
+    int kerr;
 
-    /* Invariants to make life easier. */
-    g_return_val_if_fail (input->bufsz == output->bufsz, TRUE);
     g_assert (input->mode & IO_MODE_READ);
-    g_assert (output->mode & IO_MODE_WRITE);
+    g_assert (output->mode == IO_MODE_WRITE);
 
-    if (input->s.read.curpos == input->bufsz) {
-	if (_io_read (input, err))
-	    return TRUE;
+    /* Copy everything remaining in @input to @output, leaving @input
+     * at EOF. First, pass along whatever the input has buffered. (The
+     * whole of a mapped input is "buffered", but the kernel can copy
+     * it more cheaply than we can.) */
+
+    if (input->s.read.mapped)
+	inofs = input->s.read.curpos;
+    else {
+	limit = input->s.read.eof ? input->s.read.endpos : input->bufsz;
+
+	if (input->s.read.curpos < limit) {
+	    if (io_write_raw (output, limit - input->s.read.curpos,
+			      input->s.read.buf + input->s.read.curpos, err))
+		return TRUE;
+	    input->s.read.curpos = limit;
+	}
+
+	if (input->s.read.eof)
+	    return FALSE;
+
+	inofs = io_tell (input);
     }
 
-    if (output->s.write.curpos == output->bufsz) {
-	if (_io_write (output, err))
-	    return TRUE;
+    if (fstat (input->fd, &statbuf) || !S_ISREG (statbuf.st_mode)) {
+	/* Can't address the input by offset, so do it the old-fashioned
+	 * way. */
+	while (!input->s.read.eof) {
+	    if (_io_read (input, err))
+		return TRUE;
+
+	    limit = input->s.read.eof ? input->s.read.endpos : input->bufsz;
+
+	    if (io_write_raw (output, limit - input->s.read.curpos,
+			      input->s.read.buf + input->s.read.curpos, err))
+		return TRUE;
+
+	    input->s.read.curpos = limit;
+	}
+
+	return FALSE;
     }
 
-    g_return_val_if_fail (input->s.read.curpos == output->s.write.curpos, TRUE);
+    /* We'll be reading by offset from here on, so anything reading
+     * ahead is wasted effort, and any modifications to the input need
+     * to be in the file. */
+
+    if (input->mode == IO_MODE_READ_WRITE && _io_rw_writeback (input, err))
+	return TRUE;
+
+    if (input->s.read.ra != NULL)
+	_io_readahead_stop (input->s.read.ra);
+
+    /* Get everything buffered on the output into the file. */
+
+    outofs = io_tell (output);
 
-    while (!input->s.read.eof) {
-	if (_io_fd_write (output->fd, input->s.read.buf + input->s.read.curpos,
-			  input->bufsz - input->s.read.curpos, err))
+    if (output->uring != NULL) {
+	if (_io_uring_flush (output, err))
 	    return TRUE;
-	if (_io_read (input, err))
+    } else if (output->s.write.wb != NULL) {
+	if (_io_writebehind_drain (output, err))
+	    return TRUE;
+    } else if (output->s.write.curpos > output->s.write.startpos) {
+	if (_io_write_span (output, output->s.write.buf, output->s.write.bufofs,
+			    output->s.write.startpos, output->s.write.curpos, err))
 	    return TRUE;
     }
 
-    neof = input->s.read.endpos - input->s.read.curpos;
+    /* Neither FD has anything else going on now, so we can take them
+     * out of O_DIRECT: the copy works at arbitrary offsets. The output
+     * goes back in once the kernel is done with it, since from then on
+     * its own engine (which may be a write-behind thread) handles the
+     * alignment. */
+
+    _io_direct_set (input, FALSE);
+    _io_direct_set (output, FALSE);
+    kerr = _io_kernel_copy (input->fd, &inofs, statbuf.st_size, output->fd,
+			    &outofs);
+    _io_direct_set (output, TRUE);
+
+    if (kerr > 0) {
+	_io_direct_set (input, TRUE);
+	IO_ERRNO_ERR (err, kerr, "Failed to copy stream");
+	return TRUE;
+    }
 
-    if (neof > 0) {
-	if (_io_fd_write (output->fd, input->s.read.buf + input->s.read.curpos,
-			  neof, err))
-	    return TRUE;
+    /* The output's buffer starts out empty, partway into the block
+     * containing outofs. */
+
+    output->s.write.startpos = outofs % output->bufsz;
+    output->s.write.curpos = output->s.write.startpos;
+    output->s.write.bufofs = outofs - output->s.write.startpos;
+
+    if (output->uring == NULL)
+	/* Fails harmlessly if the output is unseekable, in which case
+	 * the kernel copy didn't move it. */
+	lseek (output->fd, outofs, SEEK_SET);
+
+    /* Whatever the kernel couldn't do, we read straight into the
+     * output buffer. */
+
+    while (kerr < 0 && !failed) {
+	n = pread (input->fd, output->s.write.buf + output->s.write.curpos,
+		   output->bufsz - output->s.write.curpos, inofs);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    IO_ERRNO_ERR (err, errno, "Failed to read stream");
+	    failed = TRUE;
+	    break;
+	}
+
+	if (n == 0)
+	    break;
+
+	inofs += n;
+	output->s.write.curpos += n;
+
+	if (output->s.write.curpos == output->bufsz)
+	    failed = _io_write (output, err);
+    }
+
+    _io_direct_set (input, TRUE);
+
+    if (failed)
+	return TRUE;
+
+    /* Leave the input at EOF. */
+
+    if (input->s.read.mapped)
+	input->s.read.curpos = input->s.read.endpos;
+    else {
+	input->s.read.bufofs = inofs;
+	input->s.read.startpos = 0;
+	input->s.read.curpos = 0;
+	input->s.read.endpos = 0;
+	input->s.read.eof = TRUE;
     }
 
     return FALSE;
@@ -22,6 +22,23 @@ typedef enum _IOMode {
 extern void io_recode_data_copy (const gchar *src, gchar *dest,
 				 DSType type, gsize nvals);
 extern void io_recode_data_inplace (gchar *data, DSType type, gsize nvals);
+extern gboolean io_recode_convertible (DSType srctype, DSType desttype);
+extern gboolean io_recode_data_convert (const gchar *src, DSType srctype,
+					gpointer dest, DSType desttype,
+					gsize nvals);
+
+
+/* Buffer management. Streams take their blocks from a process-wide,
+ * thread-safe pool (see bufpool.c), which callers may use too. Buffers
+ * are aligned to IO_BUF_ALIGN, enough for O_DIRECT, and must be freed
+ * with the size they were allocated with. */
+
+#define IO_BUF_ALIGN 4096
+
+extern gpointer io_buf_alloc (gsize size);
+extern void io_buf_free (gpointer buf, gsize size);
+extern void io_buf_pool_configure (gsize max_cached, gboolean huge_pages);
+extern void io_buf_pool_trim (void);
 
 
 /* The actual I/O routines */
@@ -34,25 +51,75 @@ extern void io_recode_data_inplace (gchar *data, DSType type, gsize nvals);
 		 msg ": %s", rest, g_strerror (errno))
 
 extern IOStream *io_new_from_fd (IOMode mode, int fd, gsize bufsz, goffset align_hint);
+extern IOStream *io_new_mapped_from_fd (int fd, GError **err);
 extern void io_free (IOStream *io);
 extern gboolean io_close_and_free (IOStream *io, GError **err);
 
+extern gboolean io_enable_readahead (IOStream *io, guint nblocks, gsize bufsz,
+				     GError **err);
+extern gboolean io_enable_uring (IOStream *io, guint nblocks, GError **err);
+extern gboolean io_enable_writebehind (IOStream *io, guint nblocks, GError **err);
+extern gboolean io_enable_direct (IOStream *io, GError **err);
+
+/* How a stream is going to be used, to help the kernel manage the page
+ * cache on our behalf. SEQUENTIAL widens the kernel's read-ahead and
+ * starts it off; WILLNEED reads in the rest of the file; DONTNEED
+ * is for a single pass, evicting data behind the cursor as we go once
+ * it's been written. */
+
+typedef enum _IOAccessHint {
+    IO_HINT_NORMAL = 0,
+    IO_HINT_SEQUENTIAL,
+    IO_HINT_RANDOM,
+    IO_HINT_WILLNEED,
+    IO_HINT_DONTNEED,
+} IOAccessHint;
+
+extern void io_set_access_hint (IOStream *io, IOAccessHint hint);
+
 extern int io_get_fd (IOStream *io);
 
+/* The temp-buffer reads set *@dest to data owned by @io, valid only
+ * until the next read or seek on it. Typed values that need decoding
+ * are decoded into a single per-stream scratch buffer, leaving the
+ * stream's own buffer raw, so each such read overwrites the values
+ * from the last one even when the raw bytes haven't moved. */
+
 extern gssize io_read_into_temp_buf (IOStream *io, gsize nbytes, gpointer *dest,
 				     GError **err);
 extern gssize io_read_into_temp_buf_typed (IOStream *io, DSType type, gsize nvals,
 					   gpointer *dest, GError **err);
 extern gssize io_read_into_user_buf (IOStream *io, DSType type, gsize nvals,
 				     gpointer buf, GError **err);
+extern gssize io_read_into_user_buf_as (IOStream *io, DSType type, gsize nvals,
+					DSType desttype, gpointer buf,
+					GError **err);
 
 extern gboolean io_write_raw (IOStream *io, gsize nbytes, gconstpointer buf,
 			      GError **err);
 extern gboolean io_write_typed (IOStream *io, DSType type, gsize nvals,
 				gconstpointer buf, GError **err);
 
+/* One piece of a multi-part write: zero padding up to a multiple of
+ * @align bytes (0 or 1 for none), then @nvals values of @type. */
+
+typedef struct _IOSegment {
+    DSType type;
+    gsize nvals;
+    gconstpointer data;
+    guint8 align;
+} IOSegment;
+
+extern gboolean io_write_segments (IOStream *io, const IOSegment *segs,
+				   guint nsegs, GError **err);
+
 extern gboolean io_nudge_align (IOStream *io, gsize align_size, GError **err);
 
+extern goffset io_tell (IOStream *io);
+extern gboolean io_seek (IOStream *io, goffset offset, GError **err);
+extern gssize io_read_at (IOStream *io, goffset offset, gsize nbytes,
+			  gpointer buf, GError **err);
+
 extern gboolean io_pipe (IOStream *input, IOStream *output, GError **err);
 
 #endif
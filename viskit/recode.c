@@ -0,0 +1,556 @@
+#include <iostream.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h> /*memcpy*/
+
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define IO_RECODE_X86
+#include <immintrin.h>
+#endif
+
+
+/* Dealing with endianness conversion: MIRIAD datasets are
+ * standardized to big-endian */
+
+typedef union _IOBufptr {
+    gpointer any;
+    gint8 *i8;
+    gint16 *i16;
+    gint32 *i32;
+    gint64 *i64;
+    gfloat *f32;
+    gdouble *f64;
+    vkcomplex64 *c64;
+    gchar *text;
+} IOBufptr;
+
+typedef union _IOConstBufptr {
+    gconstpointer any;
+    const gint8 *i8;
+    const gint16 *i16;
+    const gint32 *i32;
+    const gint64 *i64;
+    const gfloat *f32;
+    const gdouble *f64;
+    const vkcomplex64 *c64;
+    const gchar *text;
+} IOConstBufptr;
+
+/* Each swap kernel converts @nvals big-endian values of one width
+ * from @src into @dest. @src and @dest may be identical (for in-place
+ * recoding) but must not otherwise overlap. The scalar versions are
+ * the reference implementations; the vectorized ones handle as many
+ * whole vectors as they can and leave the remainder to them. */
+
+typedef void (*IOSwapFunc) (const gchar *src, gchar *dest, gsize nvals);
+
+static void
+_io_swap16_scalar (const gchar *src, gchar *dest, gsize nvals)
+{
+    gsize i;
+    IOConstBufptr bsrc;
+    IOBufptr bdest;
+
+    bsrc.any = src;
+    bdest.any = dest;
+
+    for (i = 0; i < nvals; i++) {
+	*(bdest.i16) = GINT16_FROM_BE(*(bsrc.i16));
+	bdest.i16++;
+	bsrc.i16++;
+    }
+}
+
+static void
+_io_swap32_scalar (const gchar *src, gchar *dest, gsize nvals)
+{
+    gsize i;
+    IOConstBufptr bsrc;
+    IOBufptr bdest;
+
+    bsrc.any = src;
+    bdest.any = dest;
+
+    for (i = 0; i < nvals; i++) {
+	*(bdest.i32) = GINT32_FROM_BE(*(bsrc.i32));
+	bdest.i32++;
+	bsrc.i32++;
+    }
+}
+
+static void
+_io_swap64_scalar (const gchar *src, gchar *dest, gsize nvals)
+{
+    gsize i;
+    IOConstBufptr bsrc;
+    IOBufptr bdest;
+
+    bsrc.any = src;
+    bdest.any = dest;
+
+    for (i = 0; i < nvals; i++) {
+	*(bdest.i64) = GINT64_FROM_BE(*(bsrc.i64));
+	bdest.i64++;
+	bsrc.i64++;
+    }
+}
+
+
+/* Conversion kernels decode @nvals big-endian values of one type from
+ * @src and convert them to another host type in @dest, in one pass,
+ * with the same semantics as ds_type_upconvert(). They cover exactly
+ * the conversions that it does. */
+
+typedef void (*IOConvFunc) (const gchar *src, gpointer dest, gsize nvals);
+
+static inline gfloat
+_io_f32_from_be (guint32 v)
+{
+    union { guint32 u; gfloat f; } x;
+
+    x.u = GUINT32_FROM_BE (v);
+    return x.f;
+}
+
+#define IO_I8_FROM_BE(v) (v)
+
+#define CONV_SCALAR_KERNEL(sname, stype, decode, dname, dtype)		\
+    static void								\
+    _io_conv_##sname##_##dname##_scalar (const gchar *src, gpointer dest, \
+					 gsize nvals)			\
+    {									\
+	const stype *s = (const stype *) src;				\
+	dtype *d = dest;						\
+	gsize i;							\
+									\
+	for (i = 0; i < nvals; i++)					\
+	    d[i] = (dtype) decode (s[i]);				\
+    }
+
+CONV_SCALAR_KERNEL(i8, gint8, IO_I8_FROM_BE, i16, gint16)
+CONV_SCALAR_KERNEL(i8, gint8, IO_I8_FROM_BE, i32, gint32)
+CONV_SCALAR_KERNEL(i8, gint8, IO_I8_FROM_BE, i64, gint64)
+CONV_SCALAR_KERNEL(i8, gint8, IO_I8_FROM_BE, f32, gfloat)
+CONV_SCALAR_KERNEL(i8, gint8, IO_I8_FROM_BE, f64, gdouble)
+CONV_SCALAR_KERNEL(i8, gint8, IO_I8_FROM_BE, c64, vkcomplex64)
+CONV_SCALAR_KERNEL(i16, gint16, GINT16_FROM_BE, i32, gint32)
+CONV_SCALAR_KERNEL(i16, gint16, GINT16_FROM_BE, i64, gint64)
+CONV_SCALAR_KERNEL(i16, gint16, GINT16_FROM_BE, f32, gfloat)
+CONV_SCALAR_KERNEL(i16, gint16, GINT16_FROM_BE, f64, gdouble)
+CONV_SCALAR_KERNEL(i16, gint16, GINT16_FROM_BE, c64, vkcomplex64)
+CONV_SCALAR_KERNEL(i32, gint32, GINT32_FROM_BE, i64, gint64)
+CONV_SCALAR_KERNEL(i32, gint32, GINT32_FROM_BE, f32, gfloat)
+CONV_SCALAR_KERNEL(i32, gint32, GINT32_FROM_BE, f64, gdouble)
+CONV_SCALAR_KERNEL(i32, gint32, GINT32_FROM_BE, c64, vkcomplex64)
+CONV_SCALAR_KERNEL(i64, gint64, GINT64_FROM_BE, f32, gfloat)
+CONV_SCALAR_KERNEL(i64, gint64, GINT64_FROM_BE, f64, gdouble)
+CONV_SCALAR_KERNEL(i64, gint64, GINT64_FROM_BE, c64, vkcomplex64)
+CONV_SCALAR_KERNEL(f32, guint32, _io_f32_from_be, f64, gdouble)
+CONV_SCALAR_KERNEL(f32, guint32, _io_f32_from_be, c64, vkcomplex64)
+
+
+#ifdef IO_RECODE_X86
+
+/* SSE2 has no byte shuffle, so we build the swaps out of 16-bit
+ * shifts and word shuffles. */
+
+#define SSE2_SWAP_BYTES16(v) \
+    _mm_or_si128 (_mm_slli_epi16 ((v), 8), _mm_srli_epi16 ((v), 8))
+
+__attribute__ ((target ("sse2"))) static void
+_io_swap16_sse2 (const gchar *src, gchar *dest, gsize nvals)
+{
+    gsize i;
+
+    for (i = 0; i + 8 <= nvals; i += 8) {
+	__m128i v = _mm_loadu_si128 ((const __m128i *) (src + 2 * i));
+	_mm_storeu_si128 ((__m128i *) (dest + 2 * i), SSE2_SWAP_BYTES16 (v));
+    }
+
+    _io_swap16_scalar (src + 2 * i, dest + 2 * i, nvals - i);
+}
+
+__attribute__ ((target ("sse2"))) static void
+_io_swap32_sse2 (const gchar *src, gchar *dest, gsize nvals)
+{
+    gsize i;
+
+    for (i = 0; i + 4 <= nvals; i += 4) {
+	__m128i v = _mm_loadu_si128 ((const __m128i *) (src + 4 * i));
+	v = _mm_shufflelo_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));
+	v = _mm_shufflehi_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));
+	_mm_storeu_si128 ((__m128i *) (dest + 4 * i), SSE2_SWAP_BYTES16 (v));
+    }
+
+    _io_swap32_scalar (src + 4 * i, dest + 4 * i, nvals - i);
+}
+
+__attribute__ ((target ("sse2"))) static void
+_io_swap64_sse2 (const gchar *src, gchar *dest, gsize nvals)
+{
+    gsize i;
+
+    for (i = 0; i + 2 <= nvals; i += 2) {
+	__m128i v = _mm_loadu_si128 ((const __m128i *) (src + 8 * i));
+	v = _mm_shufflelo_epi16 (v, _MM_SHUFFLE (0, 1, 2, 3));
+	v = _mm_shufflehi_epi16 (v, _MM_SHUFFLE (0, 1, 2, 3));
+	_mm_storeu_si128 ((__m128i *) (dest + 8 * i), SSE2_SWAP_BYTES16 (v));
+    }
+
+    _io_swap64_scalar (src + 8 * i, dest + 8 * i, nvals - i);
+}
+
+/* SSSE3 and AVX2 can do any of the swaps with a single pshufb. The
+ * AVX2 shuffle operates within 128-bit lanes, so its mask is just the
+ * SSSE3 one repeated. */
+
+#define SHUF16 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+#define SHUF32 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+#define SHUF64 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+
+#define SSSE3_SWAP_KERNEL(width)					\
+    __attribute__ ((target ("ssse3"))) static void			\
+    _io_swap##width##_ssse3 (const gchar *src, gchar *dest, gsize nvals) \
+    {									\
+	const __m128i mask = _mm_setr_epi8 (SHUF##width);		\
+	const gsize nper = 128 / width;					\
+	gsize i;							\
+									\
+	for (i = 0; i + nper <= nvals; i += nper) {			\
+	    __m128i v = _mm_loadu_si128 ((const __m128i *) (src + (width / 8) * i)); \
+	    _mm_storeu_si128 ((__m128i *) (dest + (width / 8) * i),	\
+			      _mm_shuffle_epi8 (v, mask));		\
+	}								\
+									\
+	_io_swap##width##_scalar (src + (width / 8) * i,		\
+				 dest + (width / 8) * i, nvals - i);	\
+    }
+
+#define AVX2_SWAP_KERNEL(width)						\
+    __attribute__ ((target ("avx2"))) static void			\
+    _io_swap##width##_avx2 (const gchar *src, gchar *dest, gsize nvals) \
+    {									\
+	const __m256i mask = _mm256_setr_epi8 (SHUF##width, SHUF##width); \
+	const gsize nper = 256 / width;					\
+	gsize i;							\
+									\
+	for (i = 0; i + nper <= nvals; i += nper) {			\
+	    __m256i v = _mm256_loadu_si256 ((const __m256i *) (src + (width / 8) * i)); \
+	    _mm256_storeu_si256 ((__m256i *) (dest + (width / 8) * i),	\
+				 _mm256_shuffle_epi8 (v, mask));	\
+	}								\
+									\
+	_io_swap##width##_scalar (src + (width / 8) * i,		\
+				 dest + (width / 8) * i, nvals - i);	\
+    }
+
+SSSE3_SWAP_KERNEL(16)
+SSSE3_SWAP_KERNEL(32)
+SSSE3_SWAP_KERNEL(64)
+
+AVX2_SWAP_KERNEL(16)
+AVX2_SWAP_KERNEL(32)
+AVX2_SWAP_KERNEL(64)
+
+/* The AVX2 conversion kernels work eight values at a time. Each
+ * source loader byteswaps and widens eight values to 32-bit integers
+ * (or floats, for f32), and each storer converts those to the
+ * destination type. There's no vector conversion from 64-bit
+ * integers without AVX-512, so i64 sources stay scalar. */
+
+__attribute__ ((target ("avx2"))) static inline __m256i
+_io_avx2_load_i8 (const gchar *src)
+{
+    return _mm256_cvtepi8_epi32 (_mm_loadl_epi64 ((const __m128i *) src));
+}
+
+__attribute__ ((target ("avx2"))) static inline __m256i
+_io_avx2_load_i16 (const gchar *src)
+{
+    const __m128i mask = _mm_setr_epi8 (SHUF16);
+    __m128i v = _mm_loadu_si128 ((const __m128i *) src);
+
+    return _mm256_cvtepi16_epi32 (_mm_shuffle_epi8 (v, mask));
+}
+
+__attribute__ ((target ("avx2"))) static inline __m256i
+_io_avx2_load_i32 (const gchar *src)
+{
+    const __m256i mask = _mm256_setr_epi8 (SHUF32, SHUF32);
+
+    return _mm256_shuffle_epi8 (_mm256_loadu_si256 ((const __m256i *) src), mask);
+}
+
+__attribute__ ((target ("avx2"))) static inline __m256
+_io_avx2_load_f32 (const gchar *src)
+{
+    return _mm256_castsi256_ps (_io_avx2_load_i32 (src));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_io_avx2_store_i32 (gint32 *dest, __m256i v)
+{
+    _mm256_storeu_si256 ((__m256i *) dest, v);
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_io_avx2_store_i64 (gint64 *dest, __m256i v)
+{
+    _mm256_storeu_si256 ((__m256i *) dest,
+			 _mm256_cvtepi32_epi64 (_mm256_castsi256_si128 (v)));
+    _mm256_storeu_si256 ((__m256i *) (dest + 4),
+			 _mm256_cvtepi32_epi64 (_mm256_extracti128_si256 (v, 1)));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_io_avx2_store_f32 (gfloat *dest, __m256i v)
+{
+    _mm256_storeu_ps (dest, _mm256_cvtepi32_ps (v));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_io_avx2_store_f64 (gdouble *dest, __m256i v)
+{
+    _mm256_storeu_pd (dest, _mm256_cvtepi32_pd (_mm256_castsi256_si128 (v)));
+    _mm256_storeu_pd (dest + 4, _mm256_cvtepi32_pd (_mm256_extracti128_si256 (v, 1)));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_io_avx2_store_f64_ps (gdouble *dest, __m256 v)
+{
+    _mm256_storeu_pd (dest, _mm256_cvtps_pd (_mm256_castps256_ps128 (v)));
+    _mm256_storeu_pd (dest + 4, _mm256_cvtps_pd (_mm256_extractf128_ps (v, 1)));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_io_avx2_store_c64_ps (vkcomplex64 *dest, __m256 v)
+{
+    /* Interleave with zero imaginary parts. The unpacks work within
+     * 128-bit lanes, so the halves come out in the wrong order. */
+    __m256 lo = _mm256_unpacklo_ps (v, _mm256_setzero_ps ());
+    __m256 hi = _mm256_unpackhi_ps (v, _mm256_setzero_ps ());
+
+    _mm256_storeu_ps ((gfloat *) dest, _mm256_permute2f128_ps (lo, hi, 0x20));
+    _mm256_storeu_ps ((gfloat *) (dest + 4), _mm256_permute2f128_ps (lo, hi, 0x31));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_io_avx2_store_c64 (vkcomplex64 *dest, __m256i v)
+{
+    _io_avx2_store_c64_ps (dest, _mm256_cvtepi32_ps (v));
+}
+
+#define AVX2_CONV_KERNEL(sname, ssize, dname, dtype, load, store)	\
+    __attribute__ ((target ("avx2"))) static void			\
+    _io_conv_##sname##_##dname##_avx2 (const gchar *src, gpointer dest, \
+				       gsize nvals)			\
+    {									\
+	dtype *d = dest;						\
+	gsize i;							\
+									\
+	for (i = 0; i + 8 <= nvals; i += 8)				\
+	    store (d + i, load (src + ssize * i));			\
+									\
+	_io_conv_##sname##_##dname##_scalar (src + ssize * i, d + i, nvals - i); \
+    }
+
+__attribute__ ((target ("avx2"))) static void
+_io_conv_i8_i16_avx2 (const gchar *src, gpointer dest, gsize nvals)
+{
+    gint16 *d = dest;
+    gsize i;
+
+    for (i = 0; i + 16 <= nvals; i += 16) {
+	__m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+	_mm256_storeu_si256 ((__m256i *) (d + i), _mm256_cvtepi8_epi16 (v));
+    }
+
+    _io_conv_i8_i16_scalar (src + i, d + i, nvals - i);
+}
+
+AVX2_CONV_KERNEL(i8, 1, i32, gint32, _io_avx2_load_i8, _io_avx2_store_i32)
+AVX2_CONV_KERNEL(i8, 1, i64, gint64, _io_avx2_load_i8, _io_avx2_store_i64)
+AVX2_CONV_KERNEL(i8, 1, f32, gfloat, _io_avx2_load_i8, _io_avx2_store_f32)
+AVX2_CONV_KERNEL(i8, 1, f64, gdouble, _io_avx2_load_i8, _io_avx2_store_f64)
+AVX2_CONV_KERNEL(i8, 1, c64, vkcomplex64, _io_avx2_load_i8, _io_avx2_store_c64)
+AVX2_CONV_KERNEL(i16, 2, i32, gint32, _io_avx2_load_i16, _io_avx2_store_i32)
+AVX2_CONV_KERNEL(i16, 2, i64, gint64, _io_avx2_load_i16, _io_avx2_store_i64)
+AVX2_CONV_KERNEL(i16, 2, f32, gfloat, _io_avx2_load_i16, _io_avx2_store_f32)
+AVX2_CONV_KERNEL(i16, 2, f64, gdouble, _io_avx2_load_i16, _io_avx2_store_f64)
+AVX2_CONV_KERNEL(i16, 2, c64, vkcomplex64, _io_avx2_load_i16, _io_avx2_store_c64)
+AVX2_CONV_KERNEL(i32, 4, i64, gint64, _io_avx2_load_i32, _io_avx2_store_i64)
+AVX2_CONV_KERNEL(i32, 4, f32, gfloat, _io_avx2_load_i32, _io_avx2_store_f32)
+AVX2_CONV_KERNEL(i32, 4, f64, gdouble, _io_avx2_load_i32, _io_avx2_store_f64)
+AVX2_CONV_KERNEL(i32, 4, c64, vkcomplex64, _io_avx2_load_i32, _io_avx2_store_c64)
+AVX2_CONV_KERNEL(f32, 4, f64, gdouble, _io_avx2_load_f32, _io_avx2_store_f64_ps)
+AVX2_CONV_KERNEL(f32, 4, c64, vkcomplex64, _io_avx2_load_f32, _io_avx2_store_c64_ps)
+
+#endif /* IO_RECODE_X86 */
+
+
+static IOSwapFunc _io_swap16 = _io_swap16_scalar;
+static IOSwapFunc _io_swap32 = _io_swap32_scalar;
+static IOSwapFunc _io_swap64 = _io_swap64_scalar;
+
+/* Indexed by source and destination type. */
+static IOConvFunc _io_conv[DST_I64 + 1][DST_I64 + 1];
+
+#define SET_CONV(stype, dtype, sname, dname, impl) \
+    _io_conv[DST_##stype][DST_##dtype] = _io_conv_##sname##_##dname##_##impl
+
+static void
+_io_recode_init (void)
+{
+    static gsize inited = 0;
+
+    if (!g_once_init_enter (&inited))
+	return;
+
+    SET_CONV(I8, I16, i8, i16, scalar);
+    SET_CONV(I8, I32, i8, i32, scalar);
+    SET_CONV(I8, I64, i8, i64, scalar);
+    SET_CONV(I8, F32, i8, f32, scalar);
+    SET_CONV(I8, F64, i8, f64, scalar);
+    SET_CONV(I8, C64, i8, c64, scalar);
+    SET_CONV(I16, I32, i16, i32, scalar);
+    SET_CONV(I16, I64, i16, i64, scalar);
+    SET_CONV(I16, F32, i16, f32, scalar);
+    SET_CONV(I16, F64, i16, f64, scalar);
+    SET_CONV(I16, C64, i16, c64, scalar);
+    SET_CONV(I32, I64, i32, i64, scalar);
+    SET_CONV(I32, F32, i32, f32, scalar);
+    SET_CONV(I32, F64, i32, f64, scalar);
+    SET_CONV(I32, C64, i32, c64, scalar);
+    SET_CONV(I64, F32, i64, f32, scalar);
+    SET_CONV(I64, F64, i64, f64, scalar);
+    SET_CONV(I64, C64, i64, c64, scalar);
+    SET_CONV(F32, F64, f32, f64, scalar);
+    SET_CONV(F32, C64, f32, c64, scalar);
+
+#ifdef IO_RECODE_X86
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("avx2")) {
+	_io_swap16 = _io_swap16_avx2;
+	_io_swap32 = _io_swap32_avx2;
+	_io_swap64 = _io_swap64_avx2;
+
+	SET_CONV(I8, I16, i8, i16, avx2);
+	SET_CONV(I8, I32, i8, i32, avx2);
+	SET_CONV(I8, I64, i8, i64, avx2);
+	SET_CONV(I8, F32, i8, f32, avx2);
+	SET_CONV(I8, F64, i8, f64, avx2);
+	SET_CONV(I8, C64, i8, c64, avx2);
+	SET_CONV(I16, I32, i16, i32, avx2);
+	SET_CONV(I16, I64, i16, i64, avx2);
+	SET_CONV(I16, F32, i16, f32, avx2);
+	SET_CONV(I16, F64, i16, f64, avx2);
+	SET_CONV(I16, C64, i16, c64, avx2);
+	SET_CONV(I32, I64, i32, i64, avx2);
+	SET_CONV(I32, F32, i32, f32, avx2);
+	SET_CONV(I32, F64, i32, f64, avx2);
+	SET_CONV(I32, C64, i32, c64, avx2);
+	SET_CONV(F32, F64, f32, f64, avx2);
+	SET_CONV(F32, C64, f32, c64, avx2);
+    } else if (__builtin_cpu_supports ("ssse3")) {
+	_io_swap16 = _io_swap16_ssse3;
+	_io_swap32 = _io_swap32_ssse3;
+	_io_swap64 = _io_swap64_ssse3;
+    } else if (__builtin_cpu_supports ("sse2")) {
+	_io_swap16 = _io_swap16_sse2;
+	_io_swap32 = _io_swap32_sse2;
+	_io_swap64 = _io_swap64_sse2;
+    }
+#endif
+
+    g_once_init_leave (&inited, 1);
+}
+
+
+void
+io_recode_data_copy (const gchar *src, gchar *dest, DSType type, gsize nvals)
+{
+    _io_recode_init ();
+
+    switch (type) {
+    case DST_BIN:
+    case DST_I8:
+    case DST_TEXT:
+	memcpy (dest, src, nvals);
+	break;
+    case DST_I16:
+	_io_swap16 (src, dest, nvals);
+	break;
+    case DST_C64:
+	nvals *= 2;
+	/* fall through */
+    case DST_I32:
+    case DST_F32:
+	_io_swap32 (src, dest, nvals);
+	break;
+    case DST_I64:
+    case DST_F64:
+	_io_swap64 (src, dest, nvals);
+	break;
+    default:
+	g_error ("Unhandled data typecode %d!", type);
+	break;
+    }
+}
+
+void
+io_recode_data_inplace (gchar *data, DSType type, gsize nvals)
+{
+    switch (type) {
+    case DST_BIN:
+    case DST_I8:
+    case DST_TEXT:
+	break;
+    case DST_I16:
+    case DST_I32:
+    case DST_I64:
+    case DST_F32:
+    case DST_F64:
+    case DST_C64:
+	io_recode_data_copy (data, data, type, nvals);
+	break;
+    default:
+	g_error ("Unhandled data typecode %d!", type);
+	break;
+    }
+}
+
+
+gboolean
+io_recode_convertible (DSType srctype, DSType desttype)
+{
+    _io_recode_init ();
+
+    if (!DST_VALID (srctype) || !DST_VALID (desttype))
+	return FALSE;
+
+    return srctype == desttype || _io_conv[srctype][desttype] != NULL;
+}
+
+
+gboolean
+io_recode_data_convert (const gchar *src, DSType srctype, gpointer dest,
+			DSType desttype, gsize nvals)
+{
+    /* Returns TRUE if the conversion isn't supported, like
+     * ds_type_upconvert(). */
+
+    if (!io_recode_convertible (srctype, desttype))
+	return TRUE;
+
+    if (srctype == desttype)
+	io_recode_data_copy (src, dest, srctype, nvals);
+    else
+	_io_conv[srctype][desttype] (src, dest, nvals);
+
+    return FALSE;
+}
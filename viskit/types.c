@@ -1,11 +1,18 @@
 #include <types.h>
 
 #include <string.h> /*memcpy*/
+#include <math.h> /*lrintf*/
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#if defined(HAVE_IMMINTRIN_H) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define DS_TYPES_X86
+#include <immintrin.h>
+#endif
+
 const char ds_type_codes[] = "?bijrdacl";
 
 const guint8 ds_type_sizes[] = {
@@ -29,7 +36,7 @@ const gchar *ds_type_names[] = {
 
 typedef union _Dataptr {
     /* This union is identical to the endianness-recoding
-     * one found in iostream.c */
+     * one found in recode.c */
     gpointer any;
     gint8 *i8;
     gint16 *i16;
@@ -97,15 +104,324 @@ UPCONV_DO(vkcomplex64,I64,i64)
 UPCONV_DO(vkcomplex64,F32,f32)
 UPCONV_END(vkcomplex64)
 
+/* Vectorized conversions. These handle the bulk of an array, eight
+ * values at a time, and return how many values they converted; the
+ * scalar loops above take care of the rest. Each loader widens eight
+ * values to 32-bit integers (or loads floats), and each storer
+ * converts those to the destination type. There's no vector
+ * conversion from 64-bit integers without AVX-512, so i64 sources
+ * stay scalar. */
+
+typedef gsize (*DSConvFunc) (gconstpointer src, gpointer dest, gsize nvals);
+
+#ifdef DS_TYPES_X86
+
+__attribute__ ((target ("avx2"))) static inline __m256i
+_ds_avx2_load_i8 (const gint8 *src)
+{
+    return _mm256_cvtepi8_epi32 (_mm_loadl_epi64 ((const __m128i *) src));
+}
+
+__attribute__ ((target ("avx2"))) static inline __m256i
+_ds_avx2_load_i16 (const gint16 *src)
+{
+    return _mm256_cvtepi16_epi32 (_mm_loadu_si128 ((const __m128i *) src));
+}
+
+__attribute__ ((target ("avx2"))) static inline __m256i
+_ds_avx2_load_i32 (const gint32 *src)
+{
+    return _mm256_loadu_si256 ((const __m256i *) src);
+}
+
+__attribute__ ((target ("avx2"))) static inline __m256
+_ds_avx2_load_f32 (const gfloat *src)
+{
+    return _mm256_loadu_ps (src);
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_ds_avx2_store_i32 (gint32 *dest, __m256i v)
+{
+    _mm256_storeu_si256 ((__m256i *) dest, v);
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_ds_avx2_store_i64 (gint64 *dest, __m256i v)
+{
+    _mm256_storeu_si256 ((__m256i *) dest,
+			 _mm256_cvtepi32_epi64 (_mm256_castsi256_si128 (v)));
+    _mm256_storeu_si256 ((__m256i *) (dest + 4),
+			 _mm256_cvtepi32_epi64 (_mm256_extracti128_si256 (v, 1)));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_ds_avx2_store_f32 (gfloat *dest, __m256i v)
+{
+    _mm256_storeu_ps (dest, _mm256_cvtepi32_ps (v));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_ds_avx2_store_f64 (gdouble *dest, __m256i v)
+{
+    _mm256_storeu_pd (dest, _mm256_cvtepi32_pd (_mm256_castsi256_si128 (v)));
+    _mm256_storeu_pd (dest + 4, _mm256_cvtepi32_pd (_mm256_extracti128_si256 (v, 1)));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_ds_avx2_store_f64_ps (gdouble *dest, __m256 v)
+{
+    _mm256_storeu_pd (dest, _mm256_cvtps_pd (_mm256_castps256_ps128 (v)));
+    _mm256_storeu_pd (dest + 4, _mm256_cvtps_pd (_mm256_extractf128_ps (v, 1)));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_ds_avx2_store_c64_ps (vkcomplex64 *dest, __m256 v)
+{
+    /* Interleave with zero imaginary parts. The unpacks work within
+     * 128-bit lanes, so the halves come out in the wrong order. */
+    __m256 lo = _mm256_unpacklo_ps (v, _mm256_setzero_ps ());
+    __m256 hi = _mm256_unpackhi_ps (v, _mm256_setzero_ps ());
+
+    _mm256_storeu_ps ((gfloat *) dest, _mm256_permute2f128_ps (lo, hi, 0x20));
+    _mm256_storeu_ps ((gfloat *) (dest + 4), _mm256_permute2f128_ps (lo, hi, 0x31));
+}
+
+__attribute__ ((target ("avx2"))) static inline void
+_ds_avx2_store_c64 (vkcomplex64 *dest, __m256i v)
+{
+    _ds_avx2_store_c64_ps (dest, _mm256_cvtepi32_ps (v));
+}
+
+#define AVX2_CONV(slowname, sglib, dlowname, dglib)			\
+    __attribute__ ((target ("avx2"))) static gsize			\
+    _ds_conv_##slowname##_##dlowname##_avx2 (gconstpointer src, gpointer dest, \
+					     gsize nvals)		\
+    {									\
+	const sglib *s = src;						\
+	dglib *d = dest;						\
+	gsize i;							\
+									\
+	for (i = 0; i + 8 <= nvals; i += 8)				\
+	    _ds_avx2_store_##dlowname (d + i, _ds_avx2_load_##slowname (s + i)); \
+									\
+	return i;							\
+    }
+
+__attribute__ ((target ("avx2"))) static gsize
+_ds_conv_i8_i16_avx2 (gconstpointer src, gpointer dest, gsize nvals)
+{
+    const gint8 *s = src;
+    gint16 *d = dest;
+    gsize i;
+
+    for (i = 0; i + 16 <= nvals; i += 16) {
+	__m128i v = _mm_loadu_si128 ((const __m128i *) (s + i));
+	_mm256_storeu_si256 ((__m256i *) (d + i), _mm256_cvtepi8_epi16 (v));
+    }
+
+    return i;
+}
+
+AVX2_CONV(i8, gint8, i32, gint32)
+AVX2_CONV(i8, gint8, i64, gint64)
+AVX2_CONV(i8, gint8, f32, gfloat)
+AVX2_CONV(i8, gint8, f64, gdouble)
+AVX2_CONV(i8, gint8, c64, vkcomplex64)
+AVX2_CONV(i16, gint16, i32, gint32)
+AVX2_CONV(i16, gint16, i64, gint64)
+AVX2_CONV(i16, gint16, f32, gfloat)
+AVX2_CONV(i16, gint16, f64, gdouble)
+AVX2_CONV(i16, gint16, c64, vkcomplex64)
+AVX2_CONV(i32, gint32, i64, gint64)
+AVX2_CONV(i32, gint32, f32, gfloat)
+AVX2_CONV(i32, gint32, f64, gdouble)
+AVX2_CONV(i32, gint32, c64, vkcomplex64)
+
+__attribute__ ((target ("avx2"))) static gsize
+_ds_conv_f32_f64_avx2 (gconstpointer src, gpointer dest, gsize nvals)
+{
+    const gfloat *s = src;
+    gdouble *d = dest;
+    gsize i;
+
+    for (i = 0; i + 8 <= nvals; i += 8)
+	_ds_avx2_store_f64_ps (d + i, _ds_avx2_load_f32 (s + i));
+
+    return i;
+}
+
+__attribute__ ((target ("avx2"))) static gsize
+_ds_conv_f32_c64_avx2 (gconstpointer src, gpointer dest, gsize nvals)
+{
+    const gfloat *s = src;
+    vkcomplex64 *d = dest;
+    gsize i;
+
+    for (i = 0; i + 8 <= nvals; i += 8)
+	_ds_avx2_store_c64_ps (d + i, _ds_avx2_load_f32 (s + i));
+
+    return i;
+}
+
+__attribute__ ((target ("avx2"))) static gsize
+_ds_conv_f64_f32_avx2 (gconstpointer src, gpointer dest, gsize nvals)
+{
+    const gdouble *s = src;
+    gfloat *d = dest;
+    gsize i;
+
+    for (i = 0; i + 8 <= nvals; i += 8) {
+	_mm_storeu_ps (d + i, _mm256_cvtpd_ps (_mm256_loadu_pd (s + i)));
+	_mm_storeu_ps (d + i + 4, _mm256_cvtpd_ps (_mm256_loadu_pd (s + i + 4)));
+    }
+
+    return i;
+}
+
+__attribute__ ((target ("avx2"))) static gsize
+_ds_c64_maxabs_avx2 (const vkcomplex64 *src, gsize nvals, gfloat *maxabs)
+{
+    const gfloat *s = (const gfloat *) src;
+    __m256 sign = _mm256_set1_ps (-0.0f), m = _mm256_setzero_ps ();
+    __m128 m4;
+    gsize i;
+
+    for (i = 0; i + 4 <= nvals; i += 4)
+	m = _mm256_max_ps (m, _mm256_andnot_ps (sign, _mm256_loadu_ps (s + 2 * i)));
+
+    m4 = _mm_max_ps (_mm256_castps256_ps128 (m), _mm256_extractf128_ps (m, 1));
+    m4 = _mm_max_ps (m4, _mm_movehl_ps (m4, m4));
+    m4 = _mm_max_ss (m4, _mm_shuffle_ps (m4, m4, 1));
+    *maxabs = _mm_cvtss_f32 (m4);
+    return i;
+}
+
+__attribute__ ((target ("avx2"))) static gsize
+_ds_c64_to_i16_avx2 (const vkcomplex64 *src, gint16 *dest, gsize nvals,
+		     gfloat scale)
+{
+    const gfloat *s = (const gfloat *) src;
+    __m256 k = _mm256_set1_ps (scale);
+    gsize i;
+
+    /* cvtps rounds to nearest-even, like lrintf(); packs saturates,
+     * but interleaves the 128-bit lanes of its operands. */
+
+    for (i = 0; i + 8 <= nvals; i += 8) {
+	__m256i a = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_loadu_ps (s + 2 * i), k));
+	__m256i b = _mm256_cvtps_epi32 (_mm256_mul_ps (_mm256_loadu_ps (s + 2 * i + 8), k));
+	__m256i p = _mm256_permute4x64_epi64 (_mm256_packs_epi32 (a, b), 0xD8);
+	_mm256_storeu_si256 ((__m256i *) (dest + 2 * i), p);
+    }
+
+    return i;
+}
+
+__attribute__ ((target ("avx2"))) static gsize
+_ds_i16_to_c64_avx2 (const gint16 *src, vkcomplex64 *dest, gsize nvals,
+		     gfloat tscale)
+{
+    __m256 k = _mm256_set1_ps (tscale);
+    gsize i;
+
+    for (i = 0; i + 4 <= nvals; i += 4) {
+	__m256 v = _mm256_cvtepi32_ps (_ds_avx2_load_i16 (src + 2 * i));
+	_mm256_storeu_ps ((gfloat *) (dest + i), _mm256_mul_ps (v, k));
+    }
+
+    return i;
+}
+
+static gboolean _ds_have_avx2 = FALSE;
+
+#endif /* DS_TYPES_X86 */
+
+/* Indexed by source and destination type. Only conversions that
+ * ds_type_upconvert() supports belong here; the one downconversion has
+ * its own pointer. */
+static DSConvFunc _ds_conv_simd[DST_I64 + 1][DST_I64 + 1];
+static DSConvFunc _ds_conv_simd_f64_f32 = NULL;
+
+#define SET_CONV(scapname, dcapname, slowname, dlowname) \
+    _ds_conv_simd[DST_##scapname][DST_##dcapname] = \
+	_ds_conv_##slowname##_##dlowname##_avx2
+
+static void
+_ds_type_init (void)
+{
+    static gsize inited = 0;
+
+    if (!g_once_init_enter (&inited))
+	return;
+
+#ifdef DS_TYPES_X86
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("avx2")) {
+	_ds_have_avx2 = TRUE;
+	SET_CONV(I8, I16, i8, i16);
+	SET_CONV(I8, I32, i8, i32);
+	SET_CONV(I8, I64, i8, i64);
+	SET_CONV(I8, F32, i8, f32);
+	SET_CONV(I8, F64, i8, f64);
+	SET_CONV(I8, C64, i8, c64);
+	SET_CONV(I16, I32, i16, i32);
+	SET_CONV(I16, I64, i16, i64);
+	SET_CONV(I16, F32, i16, f32);
+	SET_CONV(I16, F64, i16, f64);
+	SET_CONV(I16, C64, i16, c64);
+	SET_CONV(I32, I64, i32, i64);
+	SET_CONV(I32, F32, i32, f32);
+	SET_CONV(I32, F64, i32, f64);
+	SET_CONV(I32, C64, i32, c64);
+	SET_CONV(F32, F64, f32, f64);
+	SET_CONV(F32, C64, f32, c64);
+	_ds_conv_simd_f64_f32 = _ds_conv_f64_f32_avx2;
+    }
+#endif
+
+    g_once_init_leave (&inited, 1);
+}
+
+static gsize
+_ds_type_convert_simd (DSType srctype, gpointer srcdata, DSType desttype,
+		       gpointer destdata, gsize nvals)
+{
+    DSConvFunc f;
+
+    _ds_type_init ();
+
+    if (!DST_VALID (srctype) || !DST_VALID (desttype))
+	return 0;
+
+    if ((f = _ds_conv_simd[srctype][desttype]) == NULL)
+	return 0;
+
+    return f (srcdata, destdata, nvals);
+}
+
 gboolean
 ds_type_upconvert (DSType srctype, gpointer srcdata, DSType desttype,
 		   gpointer destdata, gsize nvals)
 {
+    gsize n;
+
     if (srctype == desttype) {
 	memcpy (destdata, srcdata, nvals * ds_type_sizes[srctype]);
 	return FALSE;
     }
 
+    /* Vectorize the bulk of the conversion, if we can, and let the
+     * scalar loops finish up. Unsupported conversions have no vector
+     * kernels, so nothing is written before the scalar loops reject
+     * them. */
+
+    n = _ds_type_convert_simd (srctype, srcdata, desttype, destdata, nvals);
+    srcdata = (gchar *) srcdata + n * ds_type_sizes[srctype];
+    destdata = (gchar *) destdata + n * ds_type_sizes[desttype];
+    nvals -= n;
+
     switch (desttype) {
     case DST_I16:
 	return _ds_type_upconvert_i16 (srctype, srcdata, destdata, nvals);
@@ -124,74 +440,110 @@ ds_type_upconvert (DSType srctype, gpointer srcdata, DSType desttype,
     }
 }
 
-static const gchar *_ds_type_formats[] = {
-    "?", "%hhd", "%" G_GINT32_FORMAT, "%" G_GINT16_FORMAT,
-    "%g", "%g", NULL, "%g%+gi", "%" G_GINT64_FORMAT
-};
+/* Type downconversion. These lose precision, so they're separate
+ * from ds_type_upconvert(). */
 
-gchar *
-ds_type_format (gpointer data, DSType type, gssize nvals)
+gboolean
+ds_type_downconvert (DSType srctype, gpointer srcdata, DSType desttype,
+		     gpointer destdata, gsize nvals)
 {
-    GString *s;
-    const gchar *fmt;
-    gssize i;
-    double d1, d2;
-
-    g_assert (nvals >= 0);
-
-    if (nvals == 0)
-	return g_strdup ("<>");
-
-    if (type == DST_TEXT)
-	return g_strdup_printf ("\"%.*s\"", (int) nvals, (gchar *) data);
-
-    s = g_string_new ("");
-
-    if (nvals > 1)
-	g_string_append_c (s, '[');
-
-    fmt = _ds_type_formats[type];
-
-    for (i = 0; i < nvals; i++) {
-	if (i > 0)
-	    g_string_append (s, ", ");
-
-	switch (type) {
-	case DST_BIN:
-	    g_string_append (s, fmt);
-	    break;
-	case DST_I8:
-	    g_string_append_printf (s, fmt, *(gint8 *) data);
-	    break;
-	case DST_I16:
-	    g_string_append_printf (s, fmt, *(gint16 *) data);
-	    break;
-	case DST_I32:
-	    g_string_append_printf (s, fmt, *(gint32 *) data);
-	    break;
-	case DST_I64:
-	    g_string_append_printf (s, fmt, *(gint64 *) data);
-	    break;
-	case DST_F32:
-	    g_string_append_printf (s, fmt, (double) (*(float *) data));
-	    break;
-	case DST_F64:
-	    g_string_append_printf (s, fmt, *(double *) data);
-	    break;
-	case DST_C64:
-	    d1 = (double) (*(float *) data);
-	    d2 = (double) (*(float *) (data + 4));
-	    g_string_append_printf (s, fmt, d1, d2);
-	    break;
-	default:
-	    g_assert_not_reached ();
-	}
-
-	data += ds_type_sizes[type];
+    const gdouble *s;
+    gfloat *d;
+    gsize n;
+
+    if (srctype == desttype) {
+	memcpy (destdata, srcdata, nvals * ds_type_sizes[srctype]);
+	return FALSE;
+    }
+
+    if (srctype != DST_F64 || desttype != DST_F32)
+	return TRUE;
+
+    _ds_type_init ();
+    n = 0;
+
+    if (_ds_conv_simd_f64_f32 != NULL)
+	n = _ds_conv_simd_f64_f32 (srcdata, destdata, nvals);
+
+    s = (const gdouble *) srcdata + n;
+    d = (gfloat *) destdata + n;
+    nvals -= n;
+
+    while (nvals-- > 0)
+	*d++ = (gfloat) *s++;
+
+    return FALSE;
+}
+
+gfloat
+ds_type_downconvert_c64_scaled (const vkcomplex64 *srcdata, gint16 *destdata,
+				gsize nvals)
+{
+    const gfloat *s = (const gfloat *) srcdata;
+    gfloat maxabs = 0, scale, tscale;
+    gsize i = 0;
+
+    /* MIRIAD's packed correlation format: each complex value becomes
+     * a pair of i16s, real then imaginary, and the true value is the
+     * stored one times the returned tscale. The scale makes the
+     * largest component map to 32767. The values should be finite. */
+
+    _ds_type_init ();
+
+#ifdef DS_TYPES_X86
+    if (_ds_have_avx2)
+	i = _ds_c64_maxabs_avx2 (srcdata, nvals, &maxabs);
+#endif
+
+    for (; i < nvals; i++) {
+	maxabs = MAX (maxabs, fabsf (s[2 * i]));
+	maxabs = MAX (maxabs, fabsf (s[2 * i + 1]));
     }
 
-    if (nvals > 1)
-	g_string_append_c (s, ']');
+    if (maxabs == 0)
+	maxabs = 32767;
+
+    scale = 32767 / maxabs;
+    tscale = maxabs / 32767;
+    i = 0;
+
+#ifdef DS_TYPES_X86
+    if (_ds_have_avx2)
+	i = _ds_c64_to_i16_avx2 (srcdata, destdata, nvals, scale);
+#endif
+
+    for (i *= 2; i < 2 * nvals; i++)
+	destdata[i] = (gint16) CLAMP (lrintf (s[i] * scale), G_MININT16, G_MAXINT16);
+
+    return tscale;
+}
+
+void
+ds_type_upconvert_i16_scaled (const gint16 *srcdata, gfloat tscale,
+			      vkcomplex64 *destdata, gsize nvals)
+{
+    gfloat *d = (gfloat *) destdata;
+    gsize i = 0;
+
+    /* The inverse of ds_type_downconvert_c64_scaled(): @srcdata
+     * holds 2 * @nvals i16s. */
+
+    _ds_type_init ();
+
+#ifdef DS_TYPES_X86
+    if (_ds_have_avx2)
+	i = _ds_i16_to_c64_avx2 (srcdata, destdata, nvals, tscale);
+#endif
+
+    for (i *= 2; i < 2 * nvals; i++)
+	d[i] = srcdata[i] * tscale;
+}
+
+gchar *
+ds_type_format (gpointer data, DSType type, gssize nvals)
+{
+    GString *s = g_string_new ("");
 
+    ds_format_values (s, data, type, nvals, DS_FORMAT_PLAIN);
     return g_string_free (s, FALSE);
 }
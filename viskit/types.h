@@ -3,6 +3,7 @@
 
 #include <glib.h>
 #include <complex.h>
+#include <stdio.h>
 
 typedef enum _DSType {
     DST_BIN  = 0, /* used for heterogeneous binary data */
@@ -28,8 +29,39 @@ extern const gchar *ds_type_names[];
 extern gchar *ds_type_format (gpointer data, DSType type, gssize nvals)
     G_GNUC_WARN_UNUSED_RESULT;
 
+/* Bulk formatting (format.c). DS_FORMAT_PLAIN is ds_type_format()'s
+ * layout; CSV writes the values as one row's fields, and complex
+ * values as two fields; JSON writes an array, or a bare scalar for a
+ * single value, and complex values as [re,im] pairs. Floats are
+ * written in a short form that reads back exactly. */
+
+typedef enum _DSFormatStyle {
+    DS_FORMAT_PLAIN = 0,
+    DS_FORMAT_CSV,
+    DS_FORMAT_JSON
+} DSFormatStyle;
+
+#define DS_FORMAT_MAX_NUMLEN 32
+
+extern gsize ds_format_i64 (gint64 val, gchar *buf);
+extern gsize ds_format_f32 (gfloat val, gchar *buf);
+extern gsize ds_format_f64 (gdouble val, gchar *buf);
+
+extern void ds_format_values (GString *dest, gconstpointer data, DSType type,
+			      gssize nvals, DSFormatStyle style);
+extern gboolean ds_format_values_to_file (FILE *f, gconstpointer data,
+					  DSType type, gssize nvals,
+					  DSFormatStyle style, GError **err);
+
 extern gboolean ds_type_upconvert (DSType srctype, gpointer srcdata,
 				   DSType desttype, gpointer destdata,
 				   gsize nvals);
+extern gboolean ds_type_downconvert (DSType srctype, gpointer srcdata,
+				     DSType desttype, gpointer destdata,
+				     gsize nvals);
+extern gfloat ds_type_downconvert_c64_scaled (const vkcomplex64 *srcdata,
+					      gint16 *destdata, gsize nvals);
+extern void ds_type_upconvert_i16_scaled (const gint16 *srcdata, gfloat tscale,
+					  vkcomplex64 *destdata, gsize nvals);
 
 #endif
@@ -33,13 +33,15 @@ struct _UVIO {
     UVVariable *vars[NUMVARS];
 
     gboolean vartable_dirty;
+    gboolean keep_values; /* does each UVVariable own its data? */
 };
 
 
 static void
 _uvv_free (UVVariable *uvv)
 {
-    /* Recall that g_free of NULL is a noop */
+    /* Recall that g_free of NULL is a noop. Variables that don't own
+     * their data have it cleared in uvio_close(). */
     g_free (uvv->data);
     g_free (uvv);
 }
@@ -66,6 +68,34 @@ uvio_free (UVIO *uvio)
 }
 
 
+void
+uvio_set_keep_values (UVIO *uvio, gboolean keep)
+{
+    /* Only valid before uvio_open(). */
+    g_assert (uvio->vars_by_name == NULL);
+
+    uvio->keep_values = keep;
+}
+
+
+/* UV data are nearly always processed in a single pass from start to
+ * finish. Readers want the kernel to read ahead aggressively; writers
+ * have no use for what they've written lingering in the page cache.
+ * The vartable is small and is read in its entirety right away. These
+ * apply only to the streams we open, and hints set on the Dataset by
+ * the caller take precedence. */
+
+static void
+_uvio_default_hint (Dataset *ds, const gchar *item, IOStream *io,
+		    IOAccessHint hint)
+{
+    IOAccessHint dshint;
+
+    if (!ds_lookup_access_hint (ds, item, &dshint))
+	io_set_access_hint (io, hint);
+}
+
+
 static gboolean
 _uvio_read_vartable (UVIO *uvio, GError **err)
 {
@@ -80,6 +110,8 @@ _uvio_read_vartable (UVIO *uvio, GError **err)
     if ((vtab = ds_open_large_item (uvio->ds, "vartable", IO_MODE_READ, 0, err)) == NULL)
 	return TRUE;
 
+    _uvio_default_hint (uvio->ds, "vartable", vtab, IO_HINT_WILLNEED);
+
     vtidx = 0;
 
     while ((nread = io_read_into_temp_buf (vtab, 1, (gpointer *) &vtcur, err)) == 1) {
@@ -238,6 +270,9 @@ uvio_open (UVIO *uvio, Dataset *ds, IOMode mode, DSOpenFlags flags,
     if ((uvio->vd = ds_open_large_item (ds, "visdata", mode, flags, err)) == NULL)
 	goto bail;
 
+    _uvio_default_hint (ds, "visdata", uvio->vd, mode == IO_MODE_READ ?
+			IO_HINT_SEQUENTIAL : IO_HINT_DONTNEED);
+
     return FALSE;
 
 bail:
@@ -263,6 +298,13 @@ uvio_close (UVIO *uvio, GError **err)
     }
 
     if (uvio->vars_by_name != NULL) {
+	if (!uvio->keep_values) {
+	    gint i;
+
+	    for (i = 0; i < uvio->nvars; i++)
+		uvio->vars[i]->data = NULL;
+	}
+
 	g_hash_table_destroy (uvio->vars_by_name);
 	uvio->vars_by_name = NULL;
     }
@@ -315,7 +357,7 @@ uvio_read_next (UVIO *uvio, gpointer *data, GError **err)
     UVHeader *header;
     UVEntryType etype;
     guint8 varnum;
-    gsize nread;
+    gssize nread;
     gchar *buf;
     UVVariable *var;
     gint32 nbytes;
@@ -373,7 +415,10 @@ uvio_read_next (UVIO *uvio, gpointer *data, GError **err)
 	}
 
 	var->nvals = nbytes / ds_type_sizes[var->type];
-	var->data = g_realloc (var->data, nbytes);
+	if (uvio->keep_values)
+	    var->data = g_realloc (var->data, nbytes);
+	else
+	    var->data = NULL;
 
 	*data = (gchar *) var;
 	break;
@@ -386,11 +431,27 @@ uvio_read_next (UVIO *uvio, gpointer *data, GError **err)
 
 	var = uvio->vars[varnum];
 
+	if (var->nvals < 0) {
+	    g_set_error (err, DS_ERROR, DS_ERROR_FORMAT,
+			 "Invalid UV visdata: variable data before size");
+	    return UVET_ERROR;
+	}
+
 	if (io_nudge_align (uvio->vd, ds_type_aligns[var->type], err))
 	    return UVET_ERROR;
 
-	if ((nread = io_read_into_user_buf (uvio->vd, var->type, var->nvals,
-					    var->data, err)) < 0)
+	/* Unless asked to keep the values, hand out the decoded data
+	 * where the stream has them, rather than copying them; see
+	 * uvio.h. */
+
+	if (uvio->keep_values)
+	    nread = io_read_into_user_buf (uvio->vd, var->type, var->nvals,
+					   var->data, err);
+	else
+	    nread = io_read_into_temp_buf_typed (uvio->vd, var->type, var->nvals,
+						 (gpointer *) &var->data, err);
+
+	if (nread < 0)
 	    return UVET_ERROR;
 
 	if (nread != var->nvals) {
@@ -422,7 +483,11 @@ uvio_write_var (UVIO *uvio, const gchar *name,
 		DSType type, guint32 nvals, const gconstpointer data,
 		GError **err)
 {
-    UVHeader header = { 0, 0, 0, 0 };
+    UVHeader sizeheader = { 0, 0, UVET_SIZE, 0 };
+    UVHeader dataheader = { 0, 0, UVET_DATA, 0 };
+    IOSegment segs[4];
+    guint32 nbytes;
+    guint nsegs = 0;
     UVVariable *var;
 
     if (!(uvio->mode & IO_MODE_WRITE)) {
@@ -467,39 +532,41 @@ uvio_write_var (UVIO *uvio, const gchar *name,
 	return TRUE;
     }
 
-    if (io_nudge_align (uvio->vd, VISDATA_ALIGN, err))
-	return TRUE;
-
-    header.var = var->ident;
+    /* Emit the whole entry, including the size entry if need be, in
+     * one go. */
 
     if (var->nvals != nvals) {
-	guint32 nbytes;
-
-	header.etype = UVET_SIZE;
-
-	if (io_write_raw (uvio->vd, HSZ, &header, err))
-	    return TRUE;
-
+	sizeheader.var = var->ident;
 	nbytes = nvals * ds_type_sizes[type];
 
-	if (io_write_typed (uvio->vd, DST_I32, 1, &nbytes, err))
-	    return TRUE;
+	segs[nsegs].type = DST_BIN;
+	segs[nsegs].nvals = HSZ;
+	segs[nsegs].data = &sizeheader;
+	segs[nsegs++].align = VISDATA_ALIGN;
 
-	var->nvals = nvals;
+	segs[nsegs].type = DST_I32;
+	segs[nsegs].nvals = 1;
+	segs[nsegs].data = &nbytes;
+	segs[nsegs++].align = 0;
     }
 
-    if (io_nudge_align (uvio->vd, VISDATA_ALIGN, err))
-	return TRUE;
+    dataheader.var = var->ident;
 
-    header.etype = UVET_DATA;
+    segs[nsegs].type = DST_BIN;
+    segs[nsegs].nvals = HSZ;
+    segs[nsegs].data = &dataheader;
+    segs[nsegs++].align = VISDATA_ALIGN;
 
-    if (io_write_raw (uvio->vd, HSZ, &header, err))
-	return TRUE;
+    segs[nsegs].type = type;
+    segs[nsegs].nvals = nvals;
+    segs[nsegs].data = data;
+    segs[nsegs++].align = ds_type_aligns[type];
 
-    if (io_nudge_align (uvio->vd, ds_type_aligns[type], err))
+    if (io_write_segments (uvio->vd, segs, nsegs, err))
 	return TRUE;
 
-    return io_write_typed (uvio->vd, type, nvals, data, err);
+    var->nvals = nvals;
+    return FALSE;
 }
 
 
@@ -509,13 +576,13 @@ static const UVHeader _uvio_eor_header = { 0, 0, UVET_EOR, 0 };
 gboolean
 uvio_write_end_record (UVIO *uvio, GError **err)
 {
+    IOSegment seg = { DST_BIN, HSZ, &_uvio_eor_header, VISDATA_ALIGN };
+
     if (!(uvio->mode & IO_MODE_WRITE)) {
 	g_set_error (err, DS_ERROR, DS_ERROR_INTERNAL_PERMS,
 		     "Dataset not open in write mode");
 	return TRUE;
     }
 
-    if (io_nudge_align (uvio->vd, VISDATA_ALIGN, err))
-	return TRUE;
-    return io_write_raw (uvio->vd, HSZ, &_uvio_eor_header, err);
+    return io_write_segments (uvio->vd, &seg, 1, err);
 }
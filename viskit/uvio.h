@@ -13,6 +13,15 @@ typedef enum _UVEntryType {
     UVET_ERROR = -1 /* ditto */
 } UVEntryType;
 
+/* When reading, @data points to the values from the most recent
+ * UVET_DATA entry for the variable. By default it points into the
+ * visdata stream's buffers, so it is only valid until the next call to
+ * uvio_read_next(); copy the values if you need them for longer. After
+ * uvio_set_keep_values(), each variable keeps its own copy of its
+ * latest values instead, so that they can be looked up at any time
+ * through uvio_query_var() and friends, at the cost of a copy per
+ * entry. */
+
 typedef struct _UVVariable {
     gchar name[9];
     guint8 ident;
@@ -24,6 +33,8 @@ typedef struct _UVVariable {
 extern UVIO *uvio_alloc (void);
 extern void uvio_free (UVIO *uvio);
 
+extern void uvio_set_keep_values (UVIO *uvio, gboolean keep);
+
 extern gboolean uvio_open (UVIO *uvio, Dataset *ds, IOMode mode, DSOpenFlags flags,
 			   GError **err);
 extern gboolean uvio_close (UVIO *uvio, GError **err);